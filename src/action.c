@@ -7,10 +7,13 @@
 #include "config.h"
 #include "cursor.h"
 #include "desk.h"
+#include "keybind.h"
 #include "output.h"
 #include "parse.h"
+#include "scene.h"
 #include "scratchpad.h"
 #include "shell.h"
+#include "transaction.h"
 #include "types.h"
 
 
@@ -33,6 +36,7 @@ static void to_region(void *data);
 static void zoom_pinch(void *data);
 static void zoom_pinch_begin(void *data);
 static void zoom_scroll(void *data);
+static void set_binding_mode(void *data);
 
 
 static struct {
@@ -76,6 +80,7 @@ static struct {
     { "send_to_desk", &send_to_desk, &str_handler },
     { "scratchpad", &toggle_scratchpad, &scratchpad_handler },
     { "to_region", &to_region, &box_handler },
+    { "mode", &set_binding_mode, &name_handler },
 };
 
 
@@ -191,29 +196,12 @@ static void move_window(void *data) {
 	    return;
 	}
     }
-    double zoom = wimp.current_desk->zoom;
-    struct wlr_box damage = {
-	.x = view->x * zoom,
-	.y = view->y * zoom,
-	.width = view->surface->geometry.width * zoom,
-	.height = view->surface->geometry.height * zoom,
-    };
     struct motion motion = *(struct motion*)data;
-    if (motion.dx > 0) {
-	damage.width += motion.dx;
-    } else {
-	damage.x -= motion.dx;
-	damage.width -= motion.dx;
-    }
-    if (motion.dy > 0) {
-	damage.height += motion.dy;
-    } else {
-	damage.y -= motion.dy;
-	damage.height -= motion.dy;
-    }
+    damage_by_view(view, true);
     view->x += motion.dx;
     view->y += motion.dy;
-    damage_box(&damage, true);
+    scene_update_view(view);
+    damage_by_view(view, true);
 }
 
 
@@ -296,14 +284,9 @@ void pan_desk(void *data) {
 	dy = extents->height * (dy / 100);
     }
     unfullscreen();
-    struct view *view;
-    wl_list_for_each(view, &desk->views, link) {
-	view->x -= dx;
-	view->y -= dy;
-    }
     desk->panned_x -= dx;
     desk->panned_y -= dy;
-    damage_all_outputs();
+    scene_update_camera(desk);
 }
 
 
@@ -322,14 +305,9 @@ static void zoom(void *data) {
     desk->zoom *= f;
     double fx = wimp.cursor->x * (f - 1) / desk->zoom;
     double fy = wimp.cursor->y * (f - 1) / desk->zoom;
-    struct view *view;
-    wl_list_for_each(view, &desk->views, link) {
-	view->x -= fx;
-	view->y -= fy;
-    }
     desk->panned_x -= fx;
     desk->panned_y -= fy;
-    damage_all_outputs();
+    scene_update_camera(desk);
 }
 
 
@@ -361,6 +339,24 @@ static void zoom_pinch_begin(void *data) {
 }
 
 
+static void go_to_mark_key(xkb_keysym_t sym) {
+    actually_go_to_mark(&sym);
+}
+
+
+// the modes that wait for a mark's key, which can't be entered by name
+static struct binding_mode set_mark_mode = {
+    .name = "set_mark",
+    .any_key = &actually_set_mark,
+    .show_indicator = true,
+};
+static struct binding_mode go_to_mark_mode = {
+    .name = "go_to_mark",
+    .any_key = &go_to_mark_key,
+    .show_indicator = true,
+};
+
+
 static void set_mark(void *data) {
     struct mark *mark = calloc(1, sizeof(struct mark));
     struct desk *desk = wimp.current_desk;
@@ -370,8 +366,7 @@ static void set_mark(void *data) {
     mark->zoom = desk->zoom;
     mark->key = 0;
     wl_list_insert(&wimp.marks, &mark->link);
-    wimp.mark_waiting = true;
-    damage_mark_indicator();
+    enter_one_shot_mode(&set_mark_mode);
 }
 
 
@@ -401,26 +396,22 @@ void actually_set_mark(const xkb_keysym_t sym) {
     mark->key = sym;
 
     if (wimp.bind_marks) {
-	struct binding *kb, *tmp;
-	wl_list_for_each_safe(kb, tmp, &wimp.key_bindings, link) {
-	    if (kb->key == sym && kb->mods == 0) {
-		return;
-	    }
+	if (binding_lookup(&wimp.key_bindings, 0, sym)) {
+	    return;
 	}
-	kb = calloc(1, sizeof(struct binding));
+	struct binding *kb = calloc(1, sizeof(struct binding));
 	kb->mods = 0;
 	kb->key = sym;
 	kb->data = calloc(1, sizeof(xkb_keysym_t));
 	kb->action = &actually_go_to_mark;
 	*(xkb_keysym_t *)(kb->data) = sym;
-	wl_list_insert(&wimp.key_bindings, &kb->link);
+	binding_insert(&wimp.key_bindings, kb);
     }
 }
 
 
 static void go_to_mark(void *data) {
-    wimp.mark_waiting = true;
-    damage_mark_indicator();
+    enter_one_shot_mode(&go_to_mark_mode);
 }
 
 
@@ -444,21 +435,18 @@ void actually_go_to_mark(void *data) {
     }
 
     unfullscreen();
-    struct motion motion = {
-	.dx = mark->desk->panned_x - mark->x,
-	.dy = mark->desk->panned_y - mark->y,
-	.is_percentage = false,
-    };
+    mark->desk->panned_x = mark->x;
+    mark->desk->panned_y = mark->y;
     mark->desk->zoom = mark->zoom;
     set_desk(mark->desk);
-    pan_desk(&motion);
+    scene_update_camera(mark->desk);
 
     struct view *view;
     struct wlr_box *extents = wlr_output_layout_get_box(wimp.output_layout, NULL);
     wl_list_for_each(view, &wimp.current_desk->views, link) {
 	if (
-	    view->x + view->surface->geometry.width < 0 || extents->width < view->x ||
-	    view->y + view->surface->geometry.height < 0 || extents->height < view->y
+	    view_x(view) + view->surface->geometry.width < 0 || extents->width < view_x(view) ||
+	    view_y(view) + view->surface->geometry.height < 0 || extents->height < view_y(view)
 	) {
 	    continue;
 	}
@@ -486,8 +474,8 @@ static void halfimize(void *data) {
     }
     struct view *view = wl_container_of(wimp.current_desk->views.next, view, link);
     enum direction dir = *(enum direction*)data;
-    double vx = view->x + view->surface->geometry.width / 2;
-    double vy = view->y + view->surface->geometry.height / 2;
+    double vx = view_x(view) + view->surface->geometry.width / 2;
+    double vy = view_y(view) + view->surface->geometry.height / 2;
     double x, y, width, height;
     wlr_output_layout_closest_point(wimp.output_layout, NULL, vx, vy, &x, &y);
     struct wlr_output *output = wlr_output_layout_output_at(wimp.output_layout, x, y);
@@ -530,7 +518,9 @@ static void halfimize(void *data) {
 	.width = (width - border_width * 2) / zoom,
 	.height = (height - border_width * 2) / zoom,
     };
+    transaction_begin();
     view_apply_geometry(view, &new);
+    transaction_commit();
 }
 
 
@@ -541,11 +531,12 @@ static void maximize(void *data) {
     }
 
     struct view *view = wl_container_of(wimp.current_desk->views.next, view, link);
-    double vx = view->x + view->surface->geometry.width / 2;
-    double vy = view->y + view->surface->geometry.height / 2;
+    double vx = view_x(view) + view->surface->geometry.width / 2;
+    double vy = view_y(view) + view->surface->geometry.height / 2;
     double x, y;
     wlr_output_layout_closest_point(wimp.output_layout, NULL, vx, vy, &x, &y);
     struct wlr_output *output = wlr_output_layout_output_at(wimp.output_layout, x, y);
+    transaction_begin();
     unfullscreen();
 
     double zoom = wimp.current_desk->zoom;
@@ -557,6 +548,7 @@ static void maximize(void *data) {
 	.height = (output->height - border_width * 2) / zoom,
     };
     view_apply_geometry(view, &new);
+    transaction_commit();
 }
 
 
@@ -621,3 +613,20 @@ static void to_region(void *data) {
     wimp.cursor->x = cx;
     wimp.cursor->y = cy;
 }
+
+
+static void set_binding_mode(void *data) {
+    /* Switch to the named mode, whose bindings are used without the mod key, or
+     * back to the default bindings with "default". */
+    char *name = data;
+    if (!strcmp(name, "default")) {
+	enter_binding_mode(NULL);
+	return;
+    }
+    struct binding_mode *mode = binding_mode_from_name(name, false);
+    if (mode) {
+	enter_binding_mode(mode);
+    } else {
+	wlr_log(WLR_INFO, "No bindings have been made in mode '%s'.", name);
+    }
+}
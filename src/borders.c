@@ -0,0 +1,283 @@
+#include <GLES2/gl2.h>
+#include <math.h>
+#include <string.h>
+#include <wlr/render/gles2.h>
+
+#include "borders.h"
+#include "gl.h"
+#include "types.h"
+
+
+/* Borders and corners are solid rectangles, so rather than drawing each one as
+ * its own quad while painting views, the visible parts of every view's borders
+ * are collected into one region per colour and drawn together in a single draw
+ * call once the views have been painted. */
+
+
+static const GLchar vertex_src[] =
+    "uniform mat3 proj;\n"
+    "attribute vec2 pos;\n"
+    "attribute vec4 colour;\n"
+    "varying vec4 v_colour;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
+    "    v_colour = colour;\n"
+    "}\n";
+
+static const GLchar fragment_src[] =
+    "precision mediump float;\n"
+    "varying vec4 v_colour;\n"
+    "void main() {\n"
+    "    gl_FragColor = v_colour;\n"
+    "}\n";
+
+static struct {
+    bool tried;
+    GLuint program;
+    GLint proj;
+    GLint pos;
+    GLint colour;
+} shader = { 0 };
+
+
+static bool set_up_shader() {
+    /* The shader is built on first use, when the renderer's context is current. */
+    if (shader.tried) {
+	return shader.program != 0;
+    }
+    shader.tried = true;
+
+    if (!wlr_renderer_is_gles2(wimp.renderer)) {
+	return false;
+    }
+
+    GLuint program = gl_link_program(vertex_src, fragment_src);
+    if (!program) {
+	wlr_log(WLR_ERROR, "Failed to build border shader; borders won't be batched.");
+	return false;
+    }
+
+    shader.program = program;
+    shader.proj = glGetUniformLocation(program, "proj");
+    shader.pos = glGetAttribLocation(program, "pos");
+    shader.colour = glGetAttribLocation(program, "colour");
+    return true;
+}
+
+
+void border_batch_init(struct border_batch *batch, struct wlr_output *output) {
+    batch->output = output;
+    pixman_region32_init(&batch->covered);
+    for (int i = 0; i < BORDER_COLOURS; i++) {
+	pixman_region32_init(&batch->regions[i]);
+    }
+}
+
+
+struct surface_boxes {
+    pixman_region32_t *region;
+    double x, y, scale;
+};
+
+
+static void add_surface_box(struct wlr_surface *surface, int sx, int sy, void *data) {
+    struct surface_boxes *boxes = data;
+    pixman_region32_union_rect(
+	boxes->region, boxes->region,
+	(boxes->x + sx) * boxes->scale, (boxes->y + sy) * boxes->scale,
+	surface->current.width * boxes->scale, surface->current.height * boxes->scale
+    );
+}
+
+
+void border_batch_add_view(
+    struct border_batch *batch, struct view *view, int x, int y, double zoom,
+    bool is_focussed, bool subsurfaces
+) {
+    /* Add a view's borders to the batch. x and y are the view's output-local
+     * position before zooming, as used when rendering it. Views must be added
+     * from the top down, as the parts of each view's borders that are covered
+     * by views added before it are left out. subsurfaces is false if only the
+     * view's main surface is being drawn. */
+    struct desk *desk = wimp.current_desk;
+    struct wlr_output *output = batch->output;
+    double scale = output->scale * zoom;
+    int border_width = ceil(desk->border_width * zoom);
+    int corner = CORNER * zoom;
+    int bx = x * scale;
+    int by = y * scale;
+    int width = view->surface->surface->current.width * scale;
+    int height = view->surface->surface->current.height * scale;
+
+    // Borders are hidden by the views above and by the view's own surfaces, e.g.
+    // popups.
+    pixman_region32_t hidden;
+    pixman_region32_init_rect(&hidden, bx, by, width, height);
+    struct surface_boxes boxes = {
+	.region = &hidden,
+	.x = x,
+	.y = y,
+	.scale = scale,
+    };
+    if (subsurfaces) {
+	wlr_xdg_surface_for_each_surface(view->surface, add_surface_box, &boxes);
+    }
+
+    // without borders the view still hides the proxies below it
+    if (border_width <= 0) {
+	pixman_region32_union(&batch->covered, &batch->covered, &hidden);
+	pixman_region32_fini(&hidden);
+	return;
+    }
+
+    pixman_region32_t ring, edges;
+    pixman_region32_init_rect(
+	&ring, bx - border_width, by - border_width,
+	width + border_width * 2, height + border_width * 2
+    );
+    pixman_region32_subtract(&ring, &ring, &hidden);
+    pixman_region32_subtract(&ring, &ring, &batch->covered);
+    pixman_region32_union(&batch->covered, &batch->covered, &hidden);
+    pixman_region32_union_rect(
+	&batch->covered, &batch->covered, bx - border_width, by - border_width,
+	width + border_width * 2, height + border_width * 2
+    );
+
+    // the edges without the corners
+    pixman_region32_init(&edges);
+    int edge_width = width + border_width * 2 - corner * 2;
+    int edge_height = height + border_width * 2 - corner * 2;
+    if (edge_width > 0) {
+	pixman_region32_union_rect(
+	    &edges, &edges, bx - border_width + corner, by - border_width, edge_width, border_width
+	);
+	pixman_region32_union_rect(
+	    &edges, &edges, bx - border_width + corner, by + height, edge_width, border_width
+	);
+    }
+    if (edge_height > 0) {
+	pixman_region32_union_rect(
+	    &edges, &edges, bx - border_width, by - border_width + corner, border_width, edge_height
+	);
+	pixman_region32_union_rect(
+	    &edges, &edges, bx + width, by - border_width + corner, border_width, edge_height
+	);
+    }
+    pixman_region32_intersect(&edges, &edges, &ring);
+    pixman_region32_subtract(&ring, &ring, &edges);
+
+    pixman_region32_t *border = &batch->regions[is_focussed ? BORDER_FOCUS : BORDER_NORMAL];
+    pixman_region32_t *corners = &batch->regions[is_focussed ? CORNER_FOCUS : CORNER_NORMAL];
+    pixman_region32_union(border, border, &edges);
+    pixman_region32_union(corners, corners, &ring);
+
+    pixman_region32_fini(&hidden);
+    pixman_region32_fini(&ring);
+    pixman_region32_fini(&edges);
+}
+
+
+void border_batch_add_proxy(
+    struct border_batch *batch, struct view *view, int x, int y, double zoom, bool is_focussed
+) {
+    /* Add a view that is too small to be worth drawing to the batch as a solid
+     * box in its border colour, covering its borders too. */
+    struct wlr_output *output = batch->output;
+    double scale = output->scale * zoom;
+    int border_width = ceil(fmax(wimp.current_desk->border_width, 0) * zoom);
+    pixman_region32_t box;
+    pixman_region32_init_rect(
+	&box, x * scale - border_width, y * scale - border_width,
+	view->surface->surface->current.width * scale + border_width * 2,
+	view->surface->surface->current.height * scale + border_width * 2
+    );
+    pixman_region32_subtract(&box, &box, &batch->covered);
+    pixman_region32_union(&batch->covered, &batch->covered, &box);
+
+    pixman_region32_t *border = &batch->regions[is_focussed ? BORDER_FOCUS : BORDER_NORMAL];
+    pixman_region32_union(border, border, &box);
+    pixman_region32_fini(&box);
+}
+
+
+static float *border_colour(enum border_colour colour) {
+    struct desk *desk = wimp.current_desk;
+    switch (colour) {
+	case BORDER_NORMAL:
+	    return desk->border_normal;
+	case BORDER_FOCUS:
+	    return desk->border_focus;
+	case CORNER_NORMAL:
+	    return desk->corner_normal;
+	case CORNER_FOCUS:
+	default:
+	    return desk->corner_focus;
+    }
+}
+
+
+static void draw_batch(struct wlr_output *output, struct wl_array *vertices) {
+    float matrix[9];
+    gl_output_projection(output, matrix);
+
+    GLsizei stride = 6 * sizeof(GLfloat);
+    GLfloat *data = vertices->data;
+    glUseProgram(shader.program);
+    glUniformMatrix3fv(shader.proj, 1, GL_FALSE, matrix);
+    glVertexAttribPointer(shader.pos, 2, GL_FLOAT, GL_FALSE, stride, data);
+    glVertexAttribPointer(shader.colour, 4, GL_FLOAT, GL_FALSE, stride, data + 2);
+    glEnableVertexAttribArray(shader.pos);
+    glEnableVertexAttribArray(shader.colour);
+    glDrawArrays(GL_TRIANGLES, 0, vertices->size / stride);
+    glDisableVertexAttribArray(shader.pos);
+    glDisableVertexAttribArray(shader.colour);
+}
+
+
+void border_batch_flush(struct border_batch *batch, pixman_region32_t *damage) {
+    /* Draw the batched borders wherever they intersect the damage. */
+    struct wlr_output *output = batch->output;
+    bool batched = set_up_shader();
+    struct wl_array vertices;
+    wl_array_init(&vertices);
+
+    wlr_renderer_scissor(wimp.renderer, NULL);
+    for (int i = 0; i < BORDER_COLOURS; i++) {
+	pixman_region32_t *region = &batch->regions[i];
+	pixman_region32_intersect(region, region, damage);
+	float *colour = border_colour(i);
+
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+	for (int j = 0; j < nrects; j++) {
+	    pixman_box32_t *r = &rects[j];
+	    if (!batched) {
+		struct wlr_box box = {
+		    .x = r->x1,
+		    .y = r->y1,
+		    .width = r->x2 - r->x1,
+		    .height = r->y2 - r->y1,
+		};
+		wlr_render_rect(wimp.renderer, &box, colour, output->transform_matrix);
+		continue;
+	    }
+	    GLfloat corners[6][2] = {
+		{ r->x1, r->y1 }, { r->x2, r->y1 }, { r->x1, r->y2 },
+		{ r->x2, r->y1 }, { r->x2, r->y2 }, { r->x1, r->y2 },
+	    };
+	    GLfloat *vertex = wl_array_add(&vertices, 6 * 6 * sizeof(GLfloat));
+	    for (int k = 0; k < 6; k++) {
+		memcpy(vertex, corners[k], 2 * sizeof(GLfloat));
+		memcpy(vertex + 2, colour, 4 * sizeof(GLfloat));
+		vertex += 6;
+	    }
+	}
+	pixman_region32_fini(region);
+    }
+
+    if (vertices.size) {
+	draw_batch(output, &vertices);
+    }
+    wl_array_release(&vertices);
+    pixman_region32_fini(&batch->covered);
+}
@@ -0,0 +1,16 @@
+#ifndef WIMP_BORDERS_H
+#define WIMP_BORDERS_H
+
+#include "types.h"
+
+void border_batch_init(struct border_batch *batch, struct wlr_output *output);
+void border_batch_add_view(
+    struct border_batch *batch, struct view *view, int x, int y, double zoom,
+    bool is_focussed, bool subsurfaces
+);
+void border_batch_add_proxy(
+    struct border_batch *batch, struct view *view, int x, int y, double zoom, bool is_focussed
+);
+void border_batch_flush(struct border_batch *batch, pixman_region32_t *damage);
+
+#endif
@@ -11,6 +11,7 @@
 #include "action.h"
 #include "config.h"
 #include "desk.h"
+#include "grid.h"
 #include "keybind.h"
 #include "output.h"
 #include "scratchpad.h"
@@ -67,9 +68,13 @@ static void load_wallpaper(struct desk *desk, char *path) {
     cairo_t *cr = cairo_create(canvas);
     cairo_set_source_surface(cr, image, 0, 0);
     cairo_paint(cr);
+    cairo_surface_flush(canvas);
 
+    // images without an alpha channel give opaque textures that hide the background
+    uint32_t format = cairo_image_surface_get_format(image) == CAIRO_FORMAT_RGB24 ?
+	DRM_FORMAT_XRGB8888 : DRM_FORMAT_ARGB8888;
     wallpaper->texture = wlr_texture_from_pixels(
-	wimp.renderer, DRM_FORMAT_ARGB8888, stride, wallpaper->width,
+	wimp.renderer, format, stride, wallpaper->width,
 	wallpaper->height, cairo_image_surface_get_data(canvas)
     );
     desk->wallpaper = wallpaper;
@@ -95,10 +100,20 @@ static void set_wallpaper(struct desk *desk, char *wallpaper) {
 }
 
 
+static uint32_t func_keys[] = {
+    XKB_KEY_F1,
+    XKB_KEY_F2,
+    XKB_KEY_F3,
+    XKB_KEY_F4,
+    XKB_KEY_F5,
+    XKB_KEY_F6,
+};
+
+
 static void disable_vt_switching() {
-    struct binding *kb, *tmp;
-    wl_list_for_each_safe(kb, tmp, &wimp.key_bindings, link) {
-	if (kb->action == &change_vt) {
+    for (unsigned i = 0; i < 6; i++) {
+	struct binding *kb = binding_lookup(&wimp.key_bindings, WLR_MODIFIER_CTRL, func_keys[i]);
+	if (kb && kb->action == &change_vt) {
 	    free_binding(kb);
 	}
     }
@@ -106,14 +121,6 @@ static void disable_vt_switching() {
 
 
 static void setup_vt_switching() {
-    uint32_t func_keys[] = {
-	XKB_KEY_F1,
-	XKB_KEY_F2,
-	XKB_KEY_F3,
-	XKB_KEY_F4,
-	XKB_KEY_F5,
-	XKB_KEY_F6,
-    };
     struct binding *kb;
 
     for (unsigned i = 0; i < 6; i++) {
@@ -123,7 +130,7 @@ static void setup_vt_switching() {
 	kb->action = &change_vt;
 	kb->data = calloc(1, sizeof(unsigned));
 	*(unsigned *)(kb->data) = i + 1;
-	wl_list_insert(wimp.key_bindings.prev, &kb->link);
+	binding_insert(&wimp.key_bindings, kb);
     }
 }
 
@@ -180,6 +187,7 @@ void set_configurable(char *message, char *response) {
 		else if (!strcasecmp(s, "width")) {
 		    if ((s = strtok(NULL, " \t\n\r")) && is_number(s)) {
 			desk->border_width = strtod(s, NULL);
+			grid_update_desk(desk);
 		    }
 		}
 	    }
@@ -264,6 +272,79 @@ void set_configurable(char *message, char *response) {
 	    wimp.auto_focus = true;
 	}
     }
+
+    // lod_thumbnail <px>
+    else if (!strcasecmp(s, "lod_thumbnail")) {
+	if ((s = strtok(NULL, " \t\n\r")) && is_number(s)) {
+	    wimp.lod_thumbnail = strtod(s, NULL);
+	    damage_all_outputs();
+	}
+    }
+
+    // lod_proxy <px>
+    else if (!strcasecmp(s, "lod_proxy")) {
+	if ((s = strtok(NULL, " \t\n\r")) && is_number(s)) {
+	    wimp.lod_proxy = strtod(s, NULL);
+	    damage_all_outputs();
+	}
+    }
+
+    // max_render_time [off|<ms>]
+    else if (!strcasecmp(s, "max_render_time")) {
+	s = strtok(NULL, " \t\n\r");
+	if (!s) {
+	    sprintf(response, "Use off or a number of milliseconds.");
+	} else if (!strcasecmp(s, "off")) {
+	    wimp.max_render_time = 0;
+	} else if (!is_number(s) || strtod(s, NULL) < 0) {
+	    sprintf(response, "max_render_time must be off or a number of milliseconds.");
+	} else {
+	    wimp.max_render_time = strtod(s, NULL);
+	}
+    }
+
+    // allow_tearing [<app_id>|none]
+    else if (!strcasecmp(s, "allow_tearing")) {
+	if (!(s = strtok(NULL, " \t\n\r"))) {
+	    return;
+	}
+	char **allowed;
+	if (!strcasecmp(s, "none")) {
+	    wl_array_for_each(allowed, &wimp.tearing_allowed) {
+		free(*allowed);
+	    }
+	    wimp.tearing_allowed.size = 0;
+	} else if ((allowed = wl_array_add(&wimp.tearing_allowed, sizeof(char *)))) {
+	    *allowed = strdup(s);
+	}
+    }
+
+    // adaptive_sync [off|on|auto] [<output>]
+    else if (!strcasecmp(s, "adaptive_sync")) {
+	s = strtok(NULL, " \t\n\r");
+	enum adaptive_sync mode;
+	if (!s) {
+	    return;
+	} else if (!strcasecmp(s, "off")) {
+	    mode = ADAPTIVE_SYNC_OFF;
+	} else if (!strcasecmp(s, "on")) {
+	    mode = ADAPTIVE_SYNC_ON;
+	} else if (!strcasecmp(s, "auto")) {
+	    mode = ADAPTIVE_SYNC_AUTO;
+	} else {
+	    return;
+	}
+	char *name = strtok(NULL, " \t\n\r");
+	if (!name) {
+	    wimp.adaptive_sync = mode;
+	}
+	struct output *output;
+	wl_list_for_each(output, &wimp.outputs, link) {
+	    if (!name || !strcmp(name, output->wlr_output->name)) {
+		set_adaptive_sync(output, mode);
+	    }
+	}
+    }
 }
 
 
@@ -8,7 +8,11 @@
 
 #include "action.h"
 #include "cursor.h"
+#include "desk.h"
+#include "output.h"
+#include "scene.h"
 #include "shell.h"
+#include "transaction.h"
 #include "types.h"
 
 #define SNAP_WIDTH 42
@@ -91,6 +95,19 @@ bool try_snap() {
 }
 
 
+static void update_snap_box(bool can_snap) {
+    /* The snap box is only repainted where damaged, so damage it whenever it
+     * appears, moves or disappears. */
+    if (wimp.can_snap) {
+	damage_box(&wimp.snap_geobox, false);
+    }
+    wimp.can_snap = can_snap && try_snap();
+    if (wimp.can_snap) {
+	damage_box(&wimp.snap_geobox, false);
+    }
+}
+
+
 void centre_cursor() {
     struct wlr_box *extents = wlr_output_layout_get_box(wimp.output_layout, NULL);
     double cx, cy;
@@ -112,8 +129,13 @@ static void on_request_cursor(struct wl_listener *listener, void *data) {
 
 
 static void process_cursor_move(uint32_t time, double zoom) {
-    wimp.grabbed_view->x = (wimp.cursor->x - wimp.grab_x) / zoom;
-    wimp.grabbed_view->y = (wimp.cursor->y - wimp.grab_y) / zoom;
+    damage_by_view(wimp.grabbed_view, true);
+    view_set_position(
+	wimp.grabbed_view,
+	(wimp.cursor->x - wimp.grab_x) / zoom, (wimp.cursor->y - wimp.grab_y) / zoom
+    );
+    scene_update_view(wimp.grabbed_view);
+    damage_by_view(wimp.grabbed_view, true);
 }
 
 
@@ -142,106 +164,17 @@ static void process_cursor_resize(uint32_t time, double zoom) {
 
 
 void *under_pointer(struct wlr_surface **surface, double *sx, double *sy, bool *is_layer) {
-    double x = wimp.cursor->x;
-    double y = wimp.cursor->y;
-    double tsx, tsy;
-    struct view *view;
-    struct layer_view *lview;
-    struct wlr_surface *tsurface;
-    struct wlr_output *wlr_output = wlr_output_layout_output_at(wimp.output_layout, x, y);
-    struct output *output = wlr_output->data;
-    int border_width = wimp.current_desk->border_width;
-
-    // overlay and top layers
-    uint32_t above[] = { ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, ZWLR_LAYER_SHELL_V1_LAYER_TOP };
-    size_t nlayers = sizeof(above) / sizeof(above[0]);
-    for (size_t i = 0; i < nlayers; i++) {
-	wl_list_for_each(lview, &output->layer_views[above[i]], link) {
-	    tsurface = wlr_layer_surface_v1_surface_at(
-		lview->surface, x - lview->geo.x, y - lview->geo.y, &tsx, &tsy
-	    );
-	    if (tsurface) {
-		*sx = tsx;
-		*sy = tsy;
-		*surface = tsurface;
-		*is_layer = true;
-		return lview;
-	    }
-	}
-    }
-
-    // scratchpads
-    struct scratchpad *scratchpad;
-    wl_list_for_each(scratchpad, &wimp.scratchpads, link) {
-	if (scratchpad->is_mapped) {
-	    view = scratchpad->view;
-	    tsurface = wlr_xdg_surface_surface_at(
-		view->surface, x - view->x, y - view->y, &tsx, &tsy
-	    );
-	    if (tsurface) {
-		*sx = tsx;
-		*sy = tsy;
-		*surface = tsurface;
-		*is_layer = false;
-		return view;
-	    }
-	}
+    struct scene_node node;
+    if (!scene_node_at(wimp.cursor->x, wimp.cursor->y, &node, surface, sx, sy)) {
+	return NULL;
     }
-
-    // clients
-    double zoom = wimp.current_desk->zoom;
-    double zx = x / zoom;
-    double zy = y / zoom;
-
-    wl_list_for_each(view, &wimp.current_desk->views, link) {
-	tsurface = wlr_xdg_surface_surface_at(
-	    view->surface, zx - view->x, zy - view->y, &tsx, &tsy
-	);
-	if (tsurface) {
-	    *sx = tsx;
-	    *sy = tsy;
-	    *surface = tsurface;
-	    *is_layer = false;
-	    return view;
-	}
-	if (border_width) {
-	    struct wlr_box bordered = {
-		.x = (view->x - border_width) * zoom,
-		.y = (view->y - border_width) * zoom,
-		.width = (view->surface->geometry.width + border_width * 2) * zoom,
-		.height = (view->surface->geometry.height + border_width * 2) * zoom,
-	    };
-	    if (wlr_box_contains_point(&bordered, zx, zy)) {
-		*sx = tsx;
-		*sy = tsy;
-		*surface = view->surface->surface;
-		*is_layer = false;
-		return view;
-	    }
-	}
+    *is_layer = node.lview != NULL;
+    if (node.lview) {
+	return node.lview;
     }
-
-    // bottom and background layers
-    uint32_t below[] = { ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND };
-    for (size_t i = 0; i < nlayers; i++) {
-	wl_list_for_each(lview, &output->layer_views[below[i]], link) {
-	    tsurface = wlr_layer_surface_v1_surface_at(
-		lview->surface, x - lview->geo.x, y - lview->geo.y, &tsx, &tsy
-	    );
-	    if (tsurface) {
-		*sx = tsx;
-		*sy = tsy;
-		*surface = tsurface;
-		*is_layer = true;
-		return lview;
-	    }
-	}
-    }
-
-    return NULL;
+    return node.view;
 }
 
-
 static enum wlr_edges pointer_in_view_corner(struct view *view) {
     /* It is assumed that the pointer is above the view. */
     double x = wimp.cursor->x;
@@ -251,8 +184,8 @@ static enum wlr_edges pointer_in_view_corner(struct view *view) {
     enum wlr_edges edges = WLR_EDGE_NONE;
 
     struct wlr_box inner = {
-	.x = view->x * zoom,
-	.y = view->y * zoom,
+	.x = view_x(view) * zoom,
+	.y = view_y(view) * zoom,
 	.width = view->surface->geometry.width * zoom,
 	.height = view->surface->geometry.height * zoom,
     };
@@ -303,25 +236,52 @@ static enum wlr_edges pointer_in_view_corner(struct view *view) {
 }
 
 
-static void process_cursor_motion(uint32_t time, double dx, double dy) {
+void flush_cursor_motion() {
+    /* Resolve the motion accumulated since the last flush against what is under
+     * the pointer now. */
     double sx, sy;
     struct wlr_seat *seat;
     struct wlr_surface *surface;
+    struct scene_node node;
     double zoom = wimp.current_desk->zoom;
+    uint32_t time = wimp.motion_time;
+    double dx = wimp.motion_dx;
+    double dy = wimp.motion_dy;
+    bool unsent = wimp.motion_unsent;
+
+    if (wimp.motion_pending) {
+	wl_event_source_timer_update(wimp.motion_timer, 0);
+	wimp.motion_pending = false;
+    }
+    wimp.motion_dx = 0;
+    wimp.motion_dy = 0;
+    wimp.motion_unsent = false;
+    wimp.pointer_generation = wimp.scene_generation;
 
     switch (wimp.cursor_mode) {
 	case CURSOR_PASSTHROUGH:
 	    seat = wimp.seat;
 	    surface = NULL;
-	    bool is_layer;
-	    struct view *view = under_pointer(&surface, &sx, &sy, &is_layer);
+	    struct view *view = NULL;
+	    bool is_layer = false;
+	    if (scene_node_at(wimp.cursor->x, wimp.cursor->y, &node, &surface, &sx, &sy)) {
+		is_layer = node.lview != NULL;
+		view = is_layer ? (void *)node.lview : (void *)node.view;
+	    }
 	    if (!view) {
 		wlr_xcursor_manager_set_cursor_image(wimp.cursor_manager, "left_ptr", wimp.cursor);
 	    }
 	    if (surface) {
+		bool entered = seat->pointer_state.focused_surface != surface;
 		wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
 		if (seat->pointer_state.focused_surface == surface) {
-		    wlr_seat_pointer_notify_motion(seat, time, sx, sy);
+		    // motion the client has already been sent is not repeated
+		    if (!entered && unsent) {
+			wlr_seat_pointer_notify_motion(seat, time, sx, sy);
+		    }
+		    wimp.pointer_zoom = node.zoom;
+		    wimp.pointer_origin_x = wimp.cursor->x - sx * node.zoom;
+		    wimp.pointer_origin_y = wimp.cursor->y - sy * node.zoom;
 		}
 		if (wimp.auto_focus && seat->keyboard_state.focused_surface != surface) {
 		    focus(view, surface, is_layer);
@@ -332,7 +292,7 @@ static void process_cursor_motion(uint32_t time, double dx, double dy) {
 	    break;
 
 	case CURSOR_MOD:
-	    if (wimp.on_mouse_motion) {
+	    if (wimp.on_mouse_motion && (dx || dy)) {
 		struct motion motion = {
 		    .dx = dx / zoom,
 		    .dy = dy / zoom,
@@ -341,7 +301,7 @@ static void process_cursor_motion(uint32_t time, double dx, double dy) {
 		wimp.on_mouse_motion(&motion);
 	    }
 	    if (wimp.grabbed_view) {
-		wimp.can_snap = try_snap();
+		update_snap_box(true);
 	    }
 	    break;
 
@@ -356,6 +316,90 @@ static void process_cursor_motion(uint32_t time, double dx, double dy) {
 }
 
 
+static int on_motion_timer(void *data) {
+    flush_cursor_motion();
+    return 0;
+}
+
+
+static void schedule_motion() {
+    /* Have the motion worked out when the output under the pointer next draws,
+     * or after two of its refreshes if it doesn't, e.g. because it is off. */
+    struct wlr_output *output = wlr_output_layout_output_at(
+	wimp.output_layout, wimp.cursor->x, wimp.cursor->y
+    );
+    int interval = 16;
+    if (output) {
+	wlr_output_schedule_frame(output);
+	if (output->refresh > 0) {
+	    interval = 1000000 / output->refresh;
+	}
+    }
+    wl_event_source_timer_update(wimp.motion_timer, interval > 0 ? interval * 2 : 1);
+}
+
+
+static bool has_children(struct wlr_surface *surface) {
+    /* Whether a surface has others drawn on or next to it that can take the
+     * pointer from it without it leaving the surface's own box. */
+    if (
+	!wl_list_empty(&surface->subsurfaces_below) ||
+	!wl_list_empty(&surface->subsurfaces_above) ||
+	wlr_surface_is_subsurface(surface)
+    ) {
+	return true;
+    }
+    if (wlr_surface_is_xdg_surface(surface)) {
+	return !wl_list_empty(&wlr_xdg_surface_from_wlr_surface(surface)->popups);
+    }
+    if (wlr_surface_is_layer_surface(surface)) {
+	return !wl_list_empty(&wlr_layer_surface_v1_from_wlr_surface(surface)->popups);
+    }
+    return false;
+}
+
+
+static void process_cursor_motion(uint32_t time, double dx, double dy) {
+    /* High rate pointers send many motion events each frame, so the hit test,
+     * focus changes and window management they lead to are only worked out
+     * once per frame, just before the output under the pointer draws. Until
+     * then, motion goes straight to the surface that has pointer focus for as
+     * long as the pointer stays within its input region, if nothing else can
+     * be on top of it. */
+    wimp.motion_dx += dx;
+    wimp.motion_dy += dy;
+    wimp.motion_time = time;
+    wimp.motion_unsent = true;
+
+    struct wlr_seat *seat = wimp.seat;
+    struct wlr_surface *surface = seat->pointer_state.focused_surface;
+    if (wimp.cursor_mode == CURSOR_PASSTHROUGH && surface) {
+	// the surface may have moved or been covered since the last hit test
+	if (wimp.pointer_generation != wimp.scene_generation || has_children(surface)) {
+	    flush_cursor_motion();
+	    return;
+	}
+	double sx = (wimp.cursor->x - wimp.pointer_origin_x) / wimp.pointer_zoom;
+	double sy = (wimp.cursor->y - wimp.pointer_origin_y) / wimp.pointer_zoom;
+	if (
+	    sx < 0 || sy < 0 ||
+	    sx >= surface->current.width || sy >= surface->current.height ||
+	    !pixman_region32_contains_point(&surface->input_region, (int)sx, (int)sy, NULL)
+	) {
+	    flush_cursor_motion();
+	    return;
+	}
+	wlr_seat_pointer_notify_motion(seat, time, sx, sy);
+	wimp.motion_unsent = false;
+    }
+
+    if (!wimp.motion_pending) {
+	wimp.motion_pending = true;
+	schedule_motion();
+    }
+}
+
+
 static void on_cursor_motion(struct wl_listener *listener, void *data){
     struct wlr_event_pointer_motion *event = data;
     if (wimp.resize_edges) {
@@ -411,6 +455,7 @@ static void on_cursor_motion_absolute(struct wl_listener *listener, void *data)
 
 static void on_cursor_button(struct wl_listener *listener, void *data) {
     struct wlr_event_pointer_button *event = data;
+    flush_cursor_motion();
     wlr_seat_pointer_notify_button(wimp.seat, event->time_msec, event->button, event->state);
     double sx, sy;
     struct wlr_surface *surface;
@@ -430,6 +475,7 @@ static void on_cursor_button(struct wl_listener *listener, void *data) {
 	    wimp.cursor_mode = CURSOR_PASSTHROUGH;
 	}
 	if (wimp.grabbed_view) {
+	    update_snap_box(false);
 	    if (try_snap()) {
 		int border_width = wimp.current_desk->border_width;
 		double zoom = wimp.current_desk->zoom;
@@ -437,10 +483,11 @@ static void on_cursor_button(struct wl_listener *listener, void *data) {
 		wimp.snap_geobox.y = (wimp.snap_geobox.y + border_width) / zoom;
 		wimp.snap_geobox.width = (wimp.snap_geobox.width - border_width * 2) / zoom;
 		wimp.snap_geobox.height = (wimp.snap_geobox.height - border_width * 2) / zoom;
+		transaction_begin();
 		view_apply_geometry(wimp.grabbed_view, &wimp.snap_geobox);
+		transaction_commit();
 	    }
 	    wimp.grabbed_view = NULL;
-	    wimp.can_snap = false;
 	    wimp.resize_edges = 0;
 	}
     }
@@ -473,11 +520,11 @@ static void on_cursor_button(struct wl_listener *listener, void *data) {
 		if (edges) {
 		    wimp.grabbed_view = view;
 		    wimp.resize_edges = edges;
-		    wimp.grab_x = wimp.cursor->x - view->x * wimp.current_desk->zoom;
-		    wimp.grab_y = wimp.cursor->y - view->y * wimp.current_desk->zoom;
+		    wimp.grab_x = wimp.cursor->x - view_x(view) * wimp.current_desk->zoom;
+		    wimp.grab_y = wimp.cursor->y - view_y(view) * wimp.current_desk->zoom;
 		    wlr_xdg_surface_get_geometry(view->surface, &wimp.grab_geobox);
-		    wimp.grab_geobox.x = view->x;
-		    wimp.grab_geobox.y = view->y;
+		    wimp.grab_geobox.x = view_x(view);
+		    wimp.grab_geobox.y = view_y(view);
 		    wimp.cursor_mode = CURSOR_RESIZE;
 		} else {
 		    focus_view(view, surface);
@@ -492,6 +539,9 @@ static void on_cursor_button(struct wl_listener *listener, void *data) {
 
 static void on_cursor_axis(struct wl_listener *listener, void *data) {
     struct wlr_event_pointer_axis *event = data;
+    if (wimp.motion_pending) {
+	flush_cursor_motion();
+    }
     if (wimp.cursor_mode == CURSOR_MOD) {
 	if (wimp.on_mouse_scroll) {
 	    struct motion motion = {
@@ -589,6 +639,10 @@ void set_up_cursor() {
     wimp.cursor_manager = wlr_xcursor_manager_create(NULL, 24);
     wlr_xcursor_manager_load(wimp.cursor_manager, 1);
 
+    struct wl_event_loop *event_loop = wl_display_get_event_loop(wimp.display);
+    wimp.motion_timer = wl_event_loop_add_timer(event_loop, on_motion_timer, NULL);
+    wimp.pointer_zoom = 1;
+
     wimp.request_cursor_listener.notify = on_request_cursor;
     wl_signal_add(&wimp.seat->events.request_set_cursor, &wimp.request_cursor_listener);
 
@@ -4,6 +4,7 @@
 #include "types.h"
 
 void centre_cursor();
+void flush_cursor_motion();
 void *under_pointer(struct wlr_surface **surface, double *sx, double *sy, bool *is_layer);
 void set_up_cursor();
 
@@ -1,6 +1,9 @@
 #include "config.h"
 #include "desk.h"
+#include "fractional_scale.h"
+#include "grid.h"
 #include "output.h"
+#include "scene.h"
 #include "scratchpad.h"
 #include "shell.h"
 #include "types.h"
@@ -10,6 +13,7 @@ static void add_desk() {
     struct desk *desk = calloc(1, sizeof(struct desk));
     wl_list_insert(wimp.desks.prev, &desk->link);
     wl_list_init(&desk->views);
+    grid_init(&desk->grid);
     assign_colour("#31475c", desk->background);
     assign_colour("#3e3e73", desk->border_normal);
     assign_colour("#31315c", desk->corner_normal);
@@ -37,6 +41,7 @@ static void remove_desk() {
     wl_list_for_each_safe(view, tview, &last->views, link) {
 	view_to_desk(view, 0);
     };
+    grid_finish(&last->grid);
     wl_list_remove(&last->link);
     free(last->wallpaper);
     free(last);
@@ -59,8 +64,7 @@ void set_desk(struct desk *desk) {
 	return;
     }
 
-    wimp.current_desk = desk;
-    damage_all_outputs();
+    scene_set_desk(desk);
 
     // If a scratchpad is focussed, keep it focussed.
     struct scratchpad *scratchpad;
@@ -98,9 +102,47 @@ void view_to_desk(struct view *view, int index) {
     if (desk) {
 	wl_list_remove(&view->link);
 	wl_list_insert(&desk->views, &view->link);
+	grid_remove_view(view);
+	view->desk = desk;
+	view->stack = ++desk->stack_top;
+	scene_update_view(view);
+	fractional_scale_schedule();
 	if (!wl_list_empty(&wimp.current_desk->views)) {
 	    struct view *next_view = wl_container_of(wimp.current_desk->views.next, view, link);
 	    focus_view(next_view, NULL);
 	}
     }
 }
+
+
+/* Views are positioned on their desk's canvas, and the desk's camera (its
+ * panned offset and zoom) is applied only when drawing, hit-testing or
+ * configuring them, so that panning and zooming never touch the views. These
+ * convert between canvas positions and positions relative to the camera at a
+ * zoom of 1, which multiplied by the zoom are layout coordinates. Scratchpads
+ * float above the desk and are positioned directly in the layout. */
+
+double view_x(struct view *view) {
+    if (view->is_scratchpad) {
+	return view->x;
+    }
+    return view->x + view->desk->panned_x;
+}
+
+
+double view_y(struct view *view) {
+    if (view->is_scratchpad) {
+	return view->y;
+    }
+    return view->y + view->desk->panned_y;
+}
+
+
+void view_set_position(struct view *view, double x, double y) {
+    view->x = x;
+    view->y = y;
+    if (!view->is_scratchpad) {
+	view->x -= view->desk->panned_x;
+	view->y -= view->desk->panned_y;
+    }
+}
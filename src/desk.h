@@ -6,5 +6,8 @@
 void configure_desks(int wanted);
 void set_desk(struct desk *desk);
 void view_to_desk(struct view *view, int index);
+double view_x(struct view *view);
+double view_y(struct view *view);
+void view_set_position(struct view *view, double x, double y);
 
 #endif
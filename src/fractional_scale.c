@@ -0,0 +1,180 @@
+#include <math.h>
+#include <wlr/types/wlr_layer_shell_v1.h>
+
+#include "fractional-scale-v1-protocol.h"
+#include "fractional_scale.h"
+#include "types.h"
+
+
+/* Clients are told the scale at which they are shown through the
+ * fractional-scale-v1 protocol, so that while a desk is zoomed out they draw
+ * smaller buffers instead of ones that are mostly thrown away when drawn. Zoom
+ * changes come in bursts, so preferred scales are only sent once the zoom has
+ * settled. Zooming in past 1 doesn't raise the scale, so that clients aren't
+ * asked for buffers many times bigger than the output. */
+
+
+static double preferred_scale(struct wlr_surface *surface) {
+    struct wlr_surface *root = wlr_surface_get_root_surface(surface);
+    if (wlr_surface_is_layer_surface(root)) {
+	struct wlr_layer_surface_v1 *layer_surface = wlr_layer_surface_v1_from_wlr_surface(root);
+	return layer_surface->output ? layer_surface->output->scale : 1;
+    }
+
+    // popups are shown at the scale of the view they belong to
+    struct wlr_xdg_surface *xdg_surface = NULL;
+    if (wlr_surface_is_xdg_surface(root)) {
+	xdg_surface = wlr_xdg_surface_from_wlr_surface(root);
+    }
+    while (xdg_surface && xdg_surface->role == WLR_XDG_SURFACE_ROLE_POPUP) {
+	struct wlr_surface *parent = xdg_surface->popup->parent;
+	xdg_surface = NULL;
+	if (parent && wlr_surface_is_xdg_surface(parent)) {
+	    xdg_surface = wlr_xdg_surface_from_wlr_surface(parent);
+	}
+    }
+
+    // Views are drawn for the output that drives their frame callbacks. Those
+    // that aren't shown anywhere are assumed to be on the densest output.
+    struct view *view = xdg_surface ? xdg_surface->data : NULL;
+    double output_scale = 1;
+    if (view && view->primary_output) {
+	output_scale = view->primary_output->scale;
+    } else {
+	struct output *output;
+	wl_list_for_each(output, &wimp.outputs, link) {
+	    output_scale = fmax(output_scale, output->wlr_output->scale);
+	}
+    }
+
+    if (!view || view->is_scratchpad || !view->desk) {
+	return output_scale;
+    }
+    return output_scale * fmin(view->desk->zoom, 1);
+}
+
+
+static void send_preferred_scale(struct fractional_scale *fractional_scale) {
+    // the scale is sent in 120ths
+    uint32_t scale = fmax(round(preferred_scale(fractional_scale->surface) * 120), 1);
+    if (scale != fractional_scale->scale) {
+	fractional_scale->scale = scale;
+	wp_fractional_scale_v1_send_preferred_scale(fractional_scale->resource, scale);
+    }
+}
+
+
+static int on_settled(void *data) {
+    struct fractional_scale *fractional_scale;
+    wl_list_for_each(fractional_scale, &wimp.fractional_scales, link) {
+	send_preferred_scale(fractional_scale);
+    }
+    return 0;
+}
+
+
+void fractional_scale_schedule() {
+    /* Something changed the scale that clients are shown at. Their preferred
+     * scales are updated once nothing has changed for a moment. */
+    wl_event_source_timer_update(wimp.fractional_scale_timer, FRACTIONAL_SCALE_DEBOUNCE);
+}
+
+
+static void free_fractional_scale(struct fractional_scale *fractional_scale) {
+    wl_resource_set_user_data(fractional_scale->resource, NULL);
+    wl_list_remove(&fractional_scale->link);
+    wl_list_remove(&fractional_scale->surface_destroy_listener.link);
+    free(fractional_scale);
+}
+
+
+static void on_resource_destroy(struct wl_resource *resource) {
+    struct fractional_scale *fractional_scale = wl_resource_get_user_data(resource);
+    if (fractional_scale) {
+	free_fractional_scale(fractional_scale);
+    }
+}
+
+
+static void on_surface_destroy(struct wl_listener *listener, void *data) {
+    struct fractional_scale *fractional_scale =
+	wl_container_of(listener, fractional_scale, surface_destroy_listener);
+    free_fractional_scale(fractional_scale);
+}
+
+
+static void handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl = {
+    .destroy = handle_destroy,
+};
+
+
+static void get_fractional_scale(
+    struct wl_client *client, struct wl_resource *manager_resource,
+    uint32_t id, struct wl_resource *surface_resource
+) {
+    struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+    struct fractional_scale *fractional_scale;
+    wl_list_for_each(fractional_scale, &wimp.fractional_scales, link) {
+	if (fractional_scale->surface == surface) {
+	    wl_resource_post_error(
+		manager_resource, WP_FRACTIONAL_SCALE_MANAGER_V1_ERROR_FRACTIONAL_SCALE_EXISTS,
+		"surface already has a fractional scale object"
+	    );
+	    return;
+	}
+    }
+
+    fractional_scale = calloc(1, sizeof(struct fractional_scale));
+    if (!fractional_scale) {
+	wl_client_post_no_memory(client);
+	return;
+    }
+    fractional_scale->resource = wl_resource_create(
+	client, &wp_fractional_scale_v1_interface, wl_resource_get_version(manager_resource), id
+    );
+    if (!fractional_scale->resource) {
+	free(fractional_scale);
+	wl_client_post_no_memory(client);
+	return;
+    }
+    wl_resource_set_implementation(
+	fractional_scale->resource, &fractional_scale_impl, fractional_scale, on_resource_destroy
+    );
+
+    fractional_scale->surface = surface;
+    fractional_scale->surface_destroy_listener.notify = on_surface_destroy;
+    wl_signal_add(&surface->events.destroy, &fractional_scale->surface_destroy_listener);
+    wl_list_insert(&wimp.fractional_scales, &fractional_scale->link);
+    send_preferred_scale(fractional_scale);
+}
+
+
+static const struct wp_fractional_scale_manager_v1_interface manager_impl = {
+    .destroy = handle_destroy,
+    .get_fractional_scale = get_fractional_scale,
+};
+
+
+static void bind_manager(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(
+	client, &wp_fractional_scale_manager_v1_interface, version, id
+    );
+    if (!resource) {
+	wl_client_post_no_memory(client);
+	return;
+    }
+    wl_resource_set_implementation(resource, &manager_impl, NULL, NULL);
+}
+
+
+void set_up_fractional_scale() {
+    wl_list_init(&wimp.fractional_scales);
+    wl_global_create(wimp.display, &wp_fractional_scale_manager_v1_interface, 1, NULL, bind_manager);
+    struct wl_event_loop *event_loop = wl_display_get_event_loop(wimp.display);
+    wimp.fractional_scale_timer = wl_event_loop_add_timer(event_loop, on_settled, NULL);
+}
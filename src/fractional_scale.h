@@ -0,0 +1,7 @@
+#ifndef WIMP_FRACTIONAL_SCALE_H
+#define WIMP_FRACTIONAL_SCALE_H
+
+void fractional_scale_schedule();
+void set_up_fractional_scale();
+
+#endif
@@ -0,0 +1,69 @@
+#include <GLES2/gl2.h>
+#include <wlr/types/wlr_matrix.h>
+
+#include "gl.h"
+#include "types.h"
+
+
+/* Helpers for the few things that are drawn with GLES2 directly rather than
+ * through the wlroots renderer. These must only be used while the renderer's
+ * context is current, i.e. between wlr_renderer_begin and wlr_renderer_end. */
+
+
+static GLuint compile_shader(GLenum type, const GLchar *src) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint ok;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (ok == GL_FALSE) {
+	glDeleteShader(shader);
+	return 0;
+    }
+    return shader;
+}
+
+
+GLuint gl_link_program(const GLchar *vertex_src, const GLchar *fragment_src) {
+    /* Build a shader program, returning 0 on failure. */
+    GLuint vertex = compile_shader(GL_VERTEX_SHADER, vertex_src);
+    GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_src);
+    if (!vertex || !fragment) {
+	if (vertex) {
+	    glDeleteShader(vertex);
+	}
+	if (fragment) {
+	    glDeleteShader(fragment);
+	}
+	return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glLinkProgram(program);
+    glDetachShader(program, vertex);
+    glDetachShader(program, fragment);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    GLint ok;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (ok == GL_FALSE) {
+	glDeleteProgram(program);
+	return 0;
+    }
+    return program;
+}
+
+
+void gl_output_projection(struct wlr_output *output, float matrix[9]) {
+    /* Get the matrix that maps output pixels to GL coordinates, ready to be
+     * passed to glUniformMatrix3fv. */
+    wlr_matrix_projection(
+	matrix, output->width, output->height, WL_OUTPUT_TRANSFORM_FLIPPED_180
+    );
+    wlr_matrix_multiply(matrix, matrix, output->transform_matrix);
+    wlr_matrix_transpose(matrix, matrix);
+}
@@ -0,0 +1,11 @@
+#ifndef WIMP_GL_H
+#define WIMP_GL_H
+
+#include <GLES2/gl2.h>
+
+#include "types.h"
+
+GLuint gl_link_program(const GLchar *vertex_src, const GLchar *fragment_src);
+void gl_output_projection(struct wlr_output *output, float matrix[9]);
+
+#endif
@@ -0,0 +1,205 @@
+#include <math.h>
+
+#include "grid.h"
+#include "types.h"
+
+
+/* Each desk keeps a sparse uniform grid of the mapped views on its canvas.
+ * Cells are GRID_CELL canvas units square and are stored in a small hash table
+ * keyed on their cell coordinates, so only occupied cells take up memory. A
+ * view is entered into every cell that its bordered box touches. */
+
+
+static unsigned cell_hash(int x, int y) {
+    return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u) % GRID_BUCKETS;
+}
+
+
+static struct grid_cell *find_cell(struct grid *grid, int x, int y) {
+    struct grid_cell *cell;
+    wl_list_for_each(cell, &grid->buckets[cell_hash(x, y)], link) {
+	if (cell->x == x && cell->y == y) {
+	    return cell;
+	}
+    }
+    return NULL;
+}
+
+
+static struct grid_cell *get_cell(struct grid *grid, int x, int y) {
+    struct grid_cell *cell = find_cell(grid, x, y);
+    if (cell) {
+	return cell;
+    }
+
+    cell = calloc(1, sizeof(struct grid_cell));
+    cell->x = x;
+    cell->y = y;
+    wl_list_init(&cell->entries);
+    wl_list_insert(&grid->buckets[cell_hash(x, y)], &cell->link);
+    grid->cell_count++;
+    return cell;
+}
+
+
+static void view_canvas_box(struct view *view, struct wlr_box *box) {
+    /* The view's bordered box in canvas coordinates. */
+    struct desk *desk = view->desk;
+    int border_width = desk->border_width;
+    int width = view->surface->surface->current.width;
+    int height = view->surface->surface->current.height;
+    if (width < view->surface->geometry.width) {
+	width = view->surface->geometry.width;
+    }
+    if (height < view->surface->geometry.height) {
+	height = view->surface->geometry.height;
+    }
+    box->x = floor(view->x) - border_width;
+    box->y = floor(view->y) - border_width;
+    box->width = width + border_width * 2 + 1;
+    box->height = height + border_width * 2 + 1;
+}
+
+
+void grid_init(struct grid *grid) {
+    for (int i = 0; i < GRID_BUCKETS; i++) {
+	wl_list_init(&grid->buckets[i]);
+    }
+    grid->cell_count = 0;
+}
+
+
+void grid_finish(struct grid *grid) {
+    struct grid_cell *cell, *tcell;
+    struct grid_entry *entry, *tentry;
+    for (int i = 0; i < GRID_BUCKETS; i++) {
+	wl_list_for_each_safe(cell, tcell, &grid->buckets[i], link) {
+	    wl_list_for_each_safe(entry, tentry, &cell->entries, cell_link) {
+		wl_list_remove(&entry->view_link);
+		free(entry);
+	    }
+	    free(cell);
+	}
+	wl_list_init(&grid->buckets[i]);
+    }
+    grid->cell_count = 0;
+}
+
+
+void grid_remove_view(struct view *view) {
+    struct grid_entry *entry, *tmp;
+    wl_list_for_each_safe(entry, tmp, &view->grid_entries, view_link) {
+	struct grid_cell *cell = entry->cell;
+	wl_list_remove(&entry->cell_link);
+	wl_list_remove(&entry->view_link);
+	free(entry);
+	if (wl_list_empty(&cell->entries)) {
+	    wl_list_remove(&cell->link);
+	    view->desk->grid.cell_count--;
+	    free(cell);
+	}
+    }
+}
+
+
+void grid_update_view(struct view *view) {
+    /* (Re)index a view at its current position and size. Only mapped views on
+     * a desk are indexed; scratchpads float above the desk and are not. */
+    if (!view->desk) {
+	return;
+    }
+    grid_remove_view(view);
+    if (view->is_scratchpad || !view->surface->mapped) {
+	return;
+    }
+
+    struct wlr_box box;
+    view_canvas_box(view, &box);
+    int x1 = floor((double)box.x / GRID_CELL);
+    int y1 = floor((double)box.y / GRID_CELL);
+    int x2 = floor((double)(box.x + box.width) / GRID_CELL);
+    int y2 = floor((double)(box.y + box.height) / GRID_CELL);
+
+    for (int x = x1; x <= x2; x++) {
+	for (int y = y1; y <= y2; y++) {
+	    struct grid_cell *cell = get_cell(&view->desk->grid, x, y);
+	    struct grid_entry *entry = calloc(1, sizeof(struct grid_entry));
+	    entry->cell = cell;
+	    entry->view = view;
+	    wl_list_insert(&cell->entries, &entry->cell_link);
+	    wl_list_insert(&view->grid_entries, &entry->view_link);
+	}
+    }
+}
+
+
+void grid_update_desk(struct desk *desk) {
+    struct view *view;
+    wl_list_for_each(view, &desk->views, link) {
+	grid_update_view(view);
+    }
+}
+
+
+static unsigned query_stamp = 0;
+
+
+static void add_cell_views(
+    struct grid_cell *cell, struct wlr_box *area, struct wl_array *views
+) {
+    struct grid_entry *entry;
+    struct wlr_box box, intersection;
+    wl_list_for_each(entry, &cell->entries, cell_link) {
+	struct view *view = entry->view;
+	if (view->query_stamp == query_stamp) {
+	    continue;
+	}
+	view->query_stamp = query_stamp;
+	view_canvas_box(view, &box);
+	if (wlr_box_intersection(&intersection, &box, area)) {
+	    struct view **added = wl_array_add(views, sizeof(struct view *));
+	    *added = view;
+	}
+    }
+}
+
+
+static int compare_stack(const void *a, const void *b) {
+    const struct view *va = *(struct view * const *)a;
+    const struct view *vb = *(struct view * const *)b;
+    return (va->stack < vb->stack) - (va->stack > vb->stack);
+}
+
+
+void grid_query(struct desk *desk, struct wlr_box *area, struct wl_array *views) {
+    /* Fill views with the indexed views whose bordered boxes intersect area,
+     * which is in canvas coordinates. They are sorted top-most first. */
+    query_stamp++;
+    struct grid *grid = &desk->grid;
+    int x1 = floor((double)area->x / GRID_CELL);
+    int y1 = floor((double)area->y / GRID_CELL);
+    int x2 = floor((double)(area->x + area->width) / GRID_CELL);
+    int y2 = floor((double)(area->y + area->height) / GRID_CELL);
+
+    struct grid_cell *cell;
+    if ((double)(x2 - x1 + 1) * (y2 - y1 + 1) > grid->cell_count) {
+	// When zoomed far out it is cheaper to visit the occupied cells.
+	for (int i = 0; i < GRID_BUCKETS; i++) {
+	    wl_list_for_each(cell, &grid->buckets[i], link) {
+		if (x1 <= cell->x && cell->x <= x2 && y1 <= cell->y && cell->y <= y2) {
+		    add_cell_views(cell, area, views);
+		}
+	    }
+	}
+    } else {
+	for (int x = x1; x <= x2; x++) {
+	    for (int y = y1; y <= y2; y++) {
+		if ((cell = find_cell(grid, x, y))) {
+		    add_cell_views(cell, area, views);
+		}
+	    }
+	}
+    }
+
+    qsort(views->data, views->size / sizeof(struct view *), sizeof(struct view *), compare_stack);
+}
@@ -0,0 +1,13 @@
+#ifndef WIMP_GRID_H
+#define WIMP_GRID_H
+
+#include "types.h"
+
+void grid_init(struct grid *grid);
+void grid_finish(struct grid *grid);
+void grid_update_view(struct view *view);
+void grid_update_desk(struct desk *desk);
+void grid_remove_view(struct view *view);
+void grid_query(struct desk *desk, struct wlr_box *area, struct wl_array *views);
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "action.h"
 #include "cursor.h"
+#include "keybind.h"
 #include "output.h"
 #include "shell.h"
 #include "types.h"
@@ -69,23 +70,33 @@ static void on_key(struct wl_listener *listener, void *data) {
 	struct keyboard *keyboard = wl_container_of(listener, keyboard, key_listener);
 	struct wlr_keyboard *wlr_kb = keyboard->device->keyboard;
 
-	if (wimp.mark_waiting) {
-	    struct mark *mark;
-	    wimp.mark_waiting = false;
-	    damage_mark_indicator();
+	// one-shot modes take whatever key comes next, e.g. to name a mark
+	struct binding_mode *mode = wimp.binding_mode;
+	if (mode && mode->any_key) {
+	    enter_binding_mode(mode->previous);
 	    xkb_state_key_get_syms(wlr_kb->xkb_state, keycode, &syms);
-	    mark = wl_container_of(wimp.marks.next, mark, link);
-	    if (mark->key) {
-		actually_go_to_mark((void *)&syms[0]);
-	    } else {
-		actually_set_mark(syms[0]);
-	    }
+	    mode->any_key(syms[0]);
 	    return;
 	}
 
+	// Keys are looked up in the rest of a chord if one was started, then in
+	// the current mode, and otherwise in the default bindings if the mod is
+	// held. Keys after the first of a chord are matched whatever modifiers
+	// are held.
 	uint32_t modifiers = wlr_keyboard_get_modifiers(keyboard->device->keyboard);
-	struct binding *kb;
-	if ((modifiers & wimp.mod)) {
+	struct binding_table *table = NULL;
+	bool in_chord = wimp.chord_waiting != NULL;
+	if (in_chord) {
+	    table = wimp.chord_waiting;
+	    wimp.chord_waiting = NULL;
+	    modifiers = 0;
+	} else if (wimp.binding_mode) {
+	    table = &wimp.binding_mode->bindings;
+	} else if ((modifiers & wimp.mod)) {
+	    table = &wimp.key_bindings;
+	}
+
+	if (table) {
 	    xkb_layout_index_t layout_index = xkb_state_key_get_layout(wlr_kb->xkb_state, keycode);
 	    int nsyms = xkb_keymap_key_get_syms_by_level(
 		wlr_kb->keymap, keycode, layout_index, 0, &syms
@@ -93,12 +104,23 @@ static void on_key(struct wl_listener *listener, void *data) {
 
 	    modifiers &= ~wimp.mod;
 	    for (int i = 0; i < nsyms; i++) {
-		wl_list_for_each(kb, &wimp.key_bindings, link) {
-		    if (syms[i] == kb->key && modifiers == kb->mods) {
+		struct binding *kb = binding_lookup(table, modifiers, syms[i]);
+		if (kb) {
+		    if (kb->chord) {
+			wimp.chord_waiting = kb->chord;
+		    } else {
 			kb->action(kb->data);
-			return;
 		    }
+		    return;
+		}
+	    }
+
+	    // a key that doesn't continue a chord cancels it, other than modifiers
+	    if (in_chord) {
+		if (nsyms > 0 && syms[0] >= XKB_KEY_Shift_L && syms[0] <= XKB_KEY_Hyper_R) {
+		    wimp.chord_waiting = table;
 		}
+		return;
 	    }
 	}
     }
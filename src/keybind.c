@@ -1,5 +1,6 @@
 #include "action.h"
 #include "keybind.h"
+#include "output.h"
 #include "parse.h"
 #include "types.h"
 
@@ -26,14 +27,116 @@ static struct dict mouse_keys[] = {
 };
 
 
+static unsigned binding_hash(enum wlr_keyboard_modifier mods, uint32_t key) {
+    /* Fibonacci hashing: the multiplication mixes every bit of the key and
+     * modifiers into the high bits of the product, which pick the bucket. */
+    uint32_t product = (key ^ (uint32_t)mods << 24) * 2654435761u;
+    return product >> (32 - BINDING_BUCKET_BITS);
+}
+
+
+void binding_table_init(struct binding_table *table) {
+    for (int i = 0; i < BINDING_BUCKETS; i++) {
+	wl_list_init(&table->buckets[i]);
+    }
+}
+
+
+void binding_table_finish(struct binding_table *table) {
+    struct binding *kb, *tmp;
+    for (int i = 0; i < BINDING_BUCKETS; i++) {
+	wl_list_for_each_safe(kb, tmp, &table->buckets[i], link) {
+	    free_binding(kb);
+	}
+    }
+}
+
+
+struct binding *binding_lookup(
+    struct binding_table *table, enum wlr_keyboard_modifier mods, uint32_t key
+) {
+    struct binding *kb;
+    wl_list_for_each(kb, &table->buckets[binding_hash(mods, key)], link) {
+	if (kb->key == key && kb->mods == mods) {
+	    return kb;
+	}
+    }
+    return NULL;
+}
+
+
+void binding_insert(struct binding_table *table, struct binding *kb) {
+    /* Add a binding to a table, replacing any made before for the same keys. */
+    struct binding *existing = binding_lookup(table, kb->mods, kb->key);
+    if (existing) {
+	free_binding(existing);
+    }
+    wl_list_insert(&table->buckets[binding_hash(kb->mods, kb->key)], &kb->link);
+}
+
+
+struct binding_mode *binding_mode_from_name(char *name, bool create) {
+    struct binding_mode *mode;
+    wl_list_for_each(mode, &wimp.binding_modes, link) {
+	if (!strcmp(mode->name, name)) {
+	    return mode;
+	}
+    }
+    if (!create) {
+	return NULL;
+    }
+    mode = calloc(1, sizeof(struct binding_mode));
+    mode->name = strdup(name);
+    binding_table_init(&mode->bindings);
+    wl_list_insert(&wimp.binding_modes, &mode->link);
+    return mode;
+}
+
+
+void enter_binding_mode(struct binding_mode *mode) {
+    /* Switch to a mode, or back to the default bindings if mode is NULL. Any
+     * chord that was started is dropped. */
+    struct binding_mode *old = wimp.binding_mode;
+    wimp.chord_waiting = NULL;
+    wimp.binding_mode = mode;
+    if ((old && old->show_indicator) != (mode && mode->show_indicator)) {
+	damage_mark_indicator();
+    }
+}
+
+
+void enter_one_shot_mode(struct binding_mode *mode) {
+    if (wimp.binding_mode != mode) {
+	mode->previous = wimp.binding_mode;
+    }
+    enter_binding_mode(mode);
+}
+
+
 void free_binding(struct binding *kb) {
     if (kb->data)
 	free(kb->data);
+    if (kb->chord) {
+	if (wimp.chord_waiting == kb->chord) {
+	    wimp.chord_waiting = NULL;
+	}
+	binding_table_finish(kb->chord);
+	free(kb->chord);
+    }
     wl_list_remove(&kb->link);
     free(kb);
 }
 
 
+static uint32_t key_from_name(char *name) {
+    uint32_t key = xkb_keysym_from_name(name, XKB_KEYSYM_NO_FLAGS);
+    if (key == XKB_KEY_NoSymbol) {
+	key = xkb_keysym_from_name(name, XKB_KEYSYM_CASE_INSENSITIVE);
+    }
+    return key;
+}
+
+
 void add_binding(char *message, char *response) {
     char *s;
     if (!(s = strtok(NULL, " \t\n\r"))) {
@@ -41,6 +144,22 @@ void add_binding(char *message, char *response) {
 	return;
     }
 
+    // bindings can be made in a mode other than the default one
+    struct binding_table *table = &wimp.key_bindings;
+    bool in_mode = false;
+    if (!strcasecmp(s, "mode")) {
+	if (!(s = strtok(NULL, " \t\n\r")) || is_number(s)) {
+	    sprintf(response, "Which mode? Mode names can't be numbers.");
+	    return;
+	}
+	table = &binding_mode_from_name(s, true)->bindings;
+	in_mode = true;
+	if (!(s = strtok(NULL, " \t\n\r"))) {
+	    sprintf(response, "What do you want to bind?");
+	    return;
+	}
+    }
+
     struct binding *kb = calloc(1, sizeof(struct binding));
     enum wlr_keyboard_modifier mod;
     bool is_mouse_binding = false;
@@ -54,27 +173,46 @@ void add_binding(char *message, char *response) {
 	kb->mods |= mod;
 	s = strtok(NULL, " \t\n\r");
     }
-
-    // key
-    kb->key = xkb_keysym_from_name(s, XKB_KEYSYM_NO_FLAGS);
-    if (kb->key == XKB_KEY_NoSymbol) {
-	kb->key = xkb_keysym_from_name(s, XKB_KEYSYM_CASE_INSENSITIVE);
+    if (!s) {
+	sprintf(response, "Command malformed/incomplete.");
+	free(kb);
+	return;
     }
 
-    if (kb->key == XKB_KEY_NoSymbol) {
-	kb->key = get(mouse_keys, s);
-	if (kb->key == 0) {
-	    sprintf(response, "No such key '%s'.", s);
+    // key, or keys separated by commas that are pressed one after another
+    uint32_t keys[CHORD_MAX];
+    int nkeys = 0;
+    char *rest;
+    for (char *name = strtok_r(s, ",", &rest); name; name = strtok_r(NULL, ",", &rest)) {
+	if (nkeys == CHORD_MAX) {
+	    sprintf(response, "Chords can have up to %i keys.", CHORD_MAX);
 	    free(kb);
 	    return;
 	}
-	is_mouse_binding = true;
+	keys[nkeys] = key_from_name(name);
+	if (keys[nkeys] == XKB_KEY_NoSymbol) {
+	    keys[nkeys] = get(mouse_keys, name);
+	    if (keys[nkeys] == 0) {
+		sprintf(response, "No such key '%s'.", name);
+		free(kb);
+		return;
+	    }
+	    is_mouse_binding = true;
+	}
+	nkeys++;
     }
+    if (is_mouse_binding && (nkeys > 1 || in_mode)) {
+	sprintf(response, "Mouse bindings can't be in chords or modes.");
+	free(kb);
+	return;
+    }
+    kb->key = keys[0];
 
     // action
     s = strtok(NULL, " \t\n\r");
     if (!s) {
 	sprintf(response,  "Command malformed/incomplete.");
+	free(kb);
 	return;
     }
     if (!get_action(s, &kb->action, strtok(NULL, "\n\r"), &kb->data, response, kb->key)) {
@@ -82,19 +220,37 @@ void add_binding(char *message, char *response) {
 	return;
     }
 
-    struct binding *kb_existing, *tmp;
-    struct wl_list *bindings;
     if (is_mouse_binding) {
-	bindings = &wimp.mouse_bindings;
-    } else {
-	bindings = &wimp.key_bindings;
+	struct binding *kb_existing, *tmp;
+	wl_list_for_each_safe(kb_existing, tmp, &wimp.mouse_bindings, link) {
+	    if (kb_existing->key == kb->key && kb_existing->mods == kb->mods) {
+		free_binding(kb_existing);
+	    }
+	}
+	wl_list_insert(wimp.mouse_bindings.prev, &kb->link);
+	return;
     }
-    wl_list_for_each_safe(kb_existing, tmp, bindings, link) {
-	if (kb_existing->key == kb->key && kb_existing->mods == kb->mods) {
-	    free_binding(kb_existing);
+
+    // Each key of a chord but the last leads to a table of the keys that can
+    // follow it. Only the first needs the modifiers.
+    for (int i = 0; i < nkeys - 1; i++) {
+	enum wlr_keyboard_modifier step_mods = i ? 0 : kb->mods;
+	struct binding *prefix = binding_lookup(table, step_mods, keys[i]);
+	if (!prefix || !prefix->chord) {
+	    prefix = calloc(1, sizeof(struct binding));
+	    prefix->mods = step_mods;
+	    prefix->key = keys[i];
+	    prefix->chord = calloc(1, sizeof(struct binding_table));
+	    binding_table_init(prefix->chord);
+	    binding_insert(table, prefix);
 	}
+	table = prefix->chord;
+    }
+    if (nkeys > 1) {
+	kb->mods = 0;
+	kb->key = keys[nkeys - 1];
     }
-    wl_list_insert(bindings->prev, &kb->link);
+    binding_insert(table, kb);
 }
 
 
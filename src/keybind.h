@@ -1,6 +1,17 @@
 #ifndef WIMP_KEYBIND_H
 #define WIMP_KEYBIND_H
 
+#include "types.h"
+
+void binding_table_init(struct binding_table *table);
+void binding_table_finish(struct binding_table *table);
+struct binding *binding_lookup(
+    struct binding_table *table, enum wlr_keyboard_modifier mods, uint32_t key
+);
+void binding_insert(struct binding_table *table, struct binding *kb);
+struct binding_mode *binding_mode_from_name(char *name, bool create);
+void enter_binding_mode(struct binding_mode *mode);
+void enter_one_shot_mode(struct binding_mode *mode);
 void free_binding(struct binding *kb);
 void add_binding(char *message, char *response);
 void set_mod(char *message, char *response);
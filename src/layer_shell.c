@@ -3,6 +3,7 @@
 
 #include "layer_shell.h"
 #include "output.h"
+#include "scene.h"
 #include "shell.h"
 
 
@@ -12,6 +13,7 @@ static void layer(struct output *output) {
     struct wlr_layer_surface_v1_state *state;
     int width, height;
     wlr_output_effective_resolution(output->wlr_output, &width, &height);
+    scene_changed();
 
     for (int i = 0; i < 4; i++) {
 	wl_list_for_each(lview, &output->layer_views[i], link) {
@@ -95,7 +97,13 @@ static void on_destroy(struct wl_listener *listener, void *data) {
 
 static void on_commit(struct wl_listener *listener, void *data) {
     struct layer_view *lview = wl_container_of(listener, lview, commit_listener);
-    damage_by_lview(lview);
+    struct wlr_surface *surface = lview->surface->surface;
+    scene_surface_committed(surface, 0, 0, &lview->shape);
+    if (surface->current.width == lview->geo.width && surface->current.height == lview->geo.height) {
+	damage_lview_surfaces(lview);
+    } else {
+	damage_by_lview(lview);
+    }
 }
 
 
@@ -4,6 +4,8 @@
 #include <wlr/backend.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_viewporter.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
 
@@ -11,14 +13,20 @@
 #include "cursor.h"
 #include "decorations.h"
 #include "desk.h"
+#include "fractional_scale.h"
+#include "grid.h"
 #include "main.h"
 #include "input.h"
 #include "ipc.h"
+#include "keybind.h"
 #include "layer_shell.h"
 #include "log.h"
 #include "output.h"
+#include "scene.h"
 #include "scratchpad.h"
 #include "shell.h"
+#include "tearing_control.h"
+#include "transaction.h"
 #include "types.h"
 
 
@@ -30,7 +38,6 @@ struct wimp wimp = {
     .on_drag3 = NULL,
     .on_pinch = NULL,
     .desk_count = 0,
-    .mark_waiting = false,
     .mark_indicator.box.width = 25,
     .mark_indicator.box.height = 25,
     .mark_indicator.box.x = 0,
@@ -40,6 +47,10 @@ struct wimp wimp = {
     .reverse_scrolling = false,
     .zoom_min = 0.2,
     .zoom_max = 5,
+    .max_render_time = 0,
+    .lod_thumbnail = 160,
+    .lod_proxy = 32,
+    .adaptive_sync = ADAPTIVE_SYNC_OFF,
 };
 
 
@@ -76,17 +87,19 @@ static void shutdown() {
 	}
 	free(kb);
     };
-    wl_list_for_each_safe(kb, tkb, &wimp.key_bindings, link) {
-	wl_list_remove(&kb->link);
-	if (kb->data) {
-	    free(kb->data);
-	}
-	free(kb);
-    };
+    binding_table_finish(&wimp.key_bindings);
+    struct binding_mode *mode, *tmode;
+    wl_list_for_each_safe(mode, tmode, &wimp.binding_modes, link) {
+	binding_table_finish(&mode->bindings);
+	wl_list_remove(&mode->link);
+	free(mode->name);
+	free(mode);
+    }
 
     struct desk *desk, *tdesk;
     struct view *view, *tview;
     wl_list_for_each_safe(desk, tdesk, &wimp.desks, link) {
+	grid_finish(&desk->grid);
 	wl_list_for_each_safe(view, tview, &desk->views, link) {
 	    wl_list_remove(&view->link);
 	    wl_list_remove(&view->map_listener.link);
@@ -145,6 +158,8 @@ int main(int argc, char *argv[])
     wimp.renderer = wlr_backend_get_renderer(wimp.backend);
     wlr_renderer_init_wl_display(wimp.renderer, wimp.display);
     wlr_compositor_create(wimp.display, wimp.renderer);
+    wlr_viewporter_create(wimp.display);
+    wimp.presentation = wlr_presentation_create(wimp.display, wimp.backend);
 
     const char *socket = wl_display_add_socket_auto(wimp.display);
     if (!socket) {
@@ -154,7 +169,8 @@ int main(int argc, char *argv[])
 
     // initialise
     wl_list_init(&wimp.desks);
-    wl_list_init(&wimp.key_bindings);
+    binding_table_init(&wimp.key_bindings);
+    wl_list_init(&wimp.binding_modes);
     wl_list_init(&wimp.mouse_bindings);
     wl_list_init(&wimp.marks);
     wl_list_init(&wimp.scratchpads);
@@ -166,6 +182,10 @@ int main(int argc, char *argv[])
     set_up_cursor();
     set_up_decorations();
     set_up_layer_shell();
+    set_up_fractional_scale();
+    set_up_tearing_control();
+    set_up_transactions();
+    set_up_scene();
     set_up_defaults();
 
     // start
@@ -1,78 +1,107 @@
 #include <math.h>
 #include <time.h>
 #include <pixman.h>
+#include <wlr/backend.h>
 #include <wlr/types/wlr_gamma_control_v1.h>
 #include <wlr/types/wlr_layer_shell_v1.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_output_management_v1.h>
+#include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/types/wlr_xdg_output_v1.h>
+#include <wlr/util/region.h>
 
+#include "borders.h"
+#include "cursor.h"
+#include "desk.h"
 #include "output.h"
+#include "scene.h"
+#include "snapshot.h"
 #include "types.h"
+#include "wallpaper.h"
 
 
 struct render_data {
     struct wlr_output *output;
     struct wlr_renderer *renderer;
-    struct wlr_surface *bordered;
-    struct timespec *when;
+    pixman_region32_t *damage;
     double zoom;
-    bool is_focussed;
     int x;
     int y;
 };
 
 
-static void render_borders(
-    struct render_data *rdata, int x, int y, int width, int height
-) {
-    double border_width = ceil(wimp.current_desk->border_width * rdata->zoom);
-    int corner = CORNER * rdata->zoom;
+static void scale_box(struct wlr_box *box, float scale) {
+    int x = box->x;
+    int y = box->y;
+    box->x = round(x * scale);
+    box->y = round(y * scale);
+    box->width = round((x + box->width) * scale) - box->x;
+    box->height = round((y + box->height) * scale) - box->y;
+}
 
-    struct wlr_output *output = rdata->output;
-    float *colour = rdata->is_focussed ?
-	wimp.current_desk->corner_focus : wimp.current_desk->corner_normal;
-
-    // edges including corners
-    struct wlr_box border = {
-	.x = x - border_width,
-	.y = y - border_width,
-	.width = width + border_width * 2,
-	.height = border_width,
+
+static void scissor_output(struct wlr_output *output, pixman_box32_t *rect) {
+    struct wlr_box box = {
+	.x = rect->x1,
+	.y = rect->y1,
+	.width = rect->x2 - rect->x1,
+	.height = rect->y2 - rect->y1,
     };
-    wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // N
-    border.y = y + height;
-    wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // S
-    border.y = y - border_width;
-    border.width = border_width;
-    border.height = height + border_width * 2;
-    wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // W
-    border.x = x + width;
-    wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // E
-
-    // edges excluding corners
-    colour = rdata->is_focussed ?  wimp.current_desk->border_focus : wimp.current_desk->border_normal;
-    border.y += corner;
-    border.height -= corner * 2;
-    if (border.height > 0) {
-	wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // E
-	border.x = x - border_width;
-	wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // W
-    } else {
-	border.x = x - border_width;
+
+    int width, height;
+    wlr_output_transformed_resolution(output, &width, &height);
+    enum wl_output_transform transform = wlr_output_transform_invert(output->transform);
+    wlr_box_transform(&box, &box, transform, width, height);
+    wlr_renderer_scissor(wimp.renderer, &box);
+}
+
+
+static void render_rect(
+    struct wlr_output *output, pixman_region32_t *output_damage,
+    struct wlr_box *box, float colour[4]
+) {
+    /* Paint a rectangle only where it intersects the output's damage. */
+    pixman_region32_t damage;
+    pixman_region32_init_rect(&damage, box->x, box->y, box->width, box->height);
+    pixman_region32_intersect(&damage, &damage, output_damage);
+
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+    for (int i = 0; i < nrects; i++) {
+	scissor_output(output, &rects[i]);
+	wlr_render_rect(wimp.renderer, box, colour, output->transform_matrix);
     }
-    border.y = y - border_width;
-    border.x += corner;
-    border.height = border_width;
-    border.width = width + border_width * 2 - corner * 2;
-    if (border.width > 0) {
-	wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // S
-	border.y = y + height;
-	wlr_render_rect(rdata->renderer, &border, colour, output->transform_matrix); // N
+
+    pixman_region32_fini(&damage);
+}
+
+
+static void render_texture(
+    struct wlr_output *output, pixman_region32_t *output_damage,
+    struct wlr_texture *texture, const struct wlr_fbox *src_box,
+    struct wlr_box *box, const float matrix[9]
+) {
+    /* Paint a texture only where it intersects the output's damage. src_box is
+     * the part of the texture to paint, in buffer pixels, or NULL for all of it. */
+    pixman_region32_t damage;
+    pixman_region32_init_rect(&damage, box->x, box->y, box->width, box->height);
+    pixman_region32_intersect(&damage, &damage, output_damage);
+
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+    for (int i = 0; i < nrects; i++) {
+	scissor_output(output, &rects[i]);
+	if (src_box) {
+	    wlr_render_subtexture_with_matrix(wimp.renderer, texture, src_box, matrix, 1);
+	} else {
+	    wlr_render_texture_with_matrix(wimp.renderer, texture, matrix, 1);
+	}
     }
+
+    pixman_region32_fini(&damage);
 }
 
 
@@ -87,38 +116,389 @@ static void render_surface(
 	return;
     }
 
-    int x = (rdata->x + sx) * output->scale * rdata->zoom;
-    int y = (rdata->y + sy) * output->scale * rdata->zoom;
-    int width = surface->current.width * output->scale * rdata->zoom;
-    int height = surface->current.height * output->scale * rdata->zoom;
-
-    if (rdata->bordered == surface && wimp.current_desk->border_width > 0) {
-	render_borders(rdata, x, y, width, height);
-    }
-
     struct wlr_box box = {
-	.x = x,
-	.y = y,
-	.width = width,
-	.height = height,
+	.x = (rdata->x + sx) * output->scale * rdata->zoom,
+	.y = (rdata->y + sy) * output->scale * rdata->zoom,
+	.width = surface->current.width * output->scale * rdata->zoom,
+	.height = surface->current.height * output->scale * rdata->zoom,
     };
 
+    // clients can crop their buffers with wp_viewporter
+    struct wlr_fbox src_box;
+    wlr_surface_get_buffer_source_box(surface, &src_box);
+
     float matrix[9];
     enum wl_output_transform transform = wlr_output_transform_invert(surface->current.transform);
     wlr_matrix_project_box(matrix, &box, transform, 0, output->transform_matrix);
-    wlr_render_texture_with_matrix(rdata->renderer, texture, matrix, 1);
+    render_texture(output, rdata->damage, texture, &src_box, &box, matrix);
+}
+
+
+struct opaque_data {
+    struct wlr_output *output;
+    pixman_region32_t *opaque;
+    int x, y;
+    double zoom;
+};
+
+
+static void add_opaque_surface(struct wlr_surface *surface, int sx, int sy, void *data) {
+    /* Add the parts of a surface that hide whatever is below it to the opaque
+     * region, in the same output coordinates that render_surface draws it at. */
+    struct opaque_data *odata = data;
+    struct wlr_texture *texture = wlr_surface_get_texture(surface);
+    if (texture == NULL) {
+	return;
+    }
+
+    double scale = odata->output->scale * odata->zoom;
+    int x = (odata->x + sx) * scale;
+    int y = (odata->y + sy) * scale;
 
-    wlr_surface_send_frame_done(surface, rdata->when);
+    if (wlr_texture_is_opaque(texture)) {
+	pixman_region32_union_rect(
+	    odata->opaque, odata->opaque, x, y,
+	    (int)(surface->current.width * scale), (int)(surface->current.height * scale)
+	);
+	return;
+    }
+
+    // only pixels fully inside of the opaque region once scaled are opaque
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(&surface->opaque_region, &nrects);
+    for (int i = 0; i < nrects; i++) {
+	int x1 = ceil(rects[i].x1 * scale);
+	int y1 = ceil(rects[i].y1 * scale);
+	int x2 = floor(rects[i].x2 * scale);
+	int y2 = floor(rects[i].y2 * scale);
+	if (x1 < x2 && y1 < y2) {
+	    pixman_region32_union_rect(
+		odata->opaque, odata->opaque, x + x1, y + y1, x2 - x1, y2 - y1
+	    );
+	}
+    }
 }
 
 
-static void on_frame(struct wl_listener *listener, void *data) {
-    struct output *output = wl_container_of(listener, output, frame_listener);
+static void occlude_items(
+    struct wlr_output *output, struct wl_array *items,
+    pixman_region32_t *damage, pixman_region32_t *covered
+) {
+    /* Working from the top down, clip each item to the damage that isn't hidden
+     * by the opaque surfaces above it. covered is left holding everything the
+     * items hide. */
+    struct scene_node *list = items->data;
+    for (int i = items->size / sizeof(struct scene_node) - 1; i >= 0; i--) {
+	pixman_region32_init(&list[i].clip);
+	pixman_region32_subtract(&list[i].clip, damage, covered);
+	struct opaque_data odata = {
+	    .output = output,
+	    .opaque = covered,
+	    .x = list[i].x,
+	    .y = list[i].y,
+	    .zoom = list[i].zoom,
+	};
+	switch (list[i].detail) {
+	    case DETAIL_FULL:
+		scene_node_for_each_surface(&list[i], add_opaque_surface, &odata);
+		break;
+	    case DETAIL_THUMBNAIL:
+		add_opaque_surface(list[i].view->surface->surface, 0, 0, &odata);
+		break;
+	    case DETAIL_PROXY:
+		// proxies are drawn with the borders, which aren't taken into account
+		break;
+	}
+    }
+}
+
+
+static void sample_surface_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    wlr_presentation_surface_sampled_on_output(wimp.presentation, surface, data);
+}
+
+
+static void render_items(struct render_data *rdata, struct scene_node *items, int from, int to) {
+    /* Draw the items within their clips. Clients get presentation feedback for
+     * what is drawn once it is presented, but not for items that are hidden
+     * or that only show up as proxies. */
+    for (int i = from; i < to; i++) {
+	struct scene_node *node = &items[i];
+	if (!pixman_region32_not_empty(&node->clip) || node->detail == DETAIL_PROXY) {
+	    pixman_region32_fini(&node->clip);
+	    continue;
+	}
+
+	// views zoomed far out are drawn from their snapshots if they can be
+	bool done;
+	if (node->detail == DETAIL_THUMBNAIL) {
+	    done = snapshot_render_thumbnail(
+		node->view, rdata->output, node->x, node->y, node->zoom, &node->clip
+	    );
+	} else {
+	    done = node->view && snapshot_render(
+		node->view, rdata->output, node->x, node->y, node->zoom, &node->clip
+	    );
+	}
+
+	if (!done) {
+	    rdata->x = node->x;
+	    rdata->y = node->y;
+	    rdata->zoom = node->zoom;
+	    rdata->damage = &node->clip;
+	    if (node->detail == DETAIL_THUMBNAIL) {
+		render_surface(node->view->surface->surface, 0, 0, rdata);
+	    } else {
+		scene_node_for_each_surface(node, render_surface, rdata);
+	    }
+	}
+
+	if (node->detail == DETAIL_THUMBNAIL) {
+	    sample_surface_iterator(node->view->surface->surface, 0, 0, rdata->output);
+	} else {
+	    scene_node_for_each_surface(node, sample_surface_iterator, rdata->output);
+	}
+	pixman_region32_fini(&node->clip);
+    }
+}
+
+
+static enum detail view_detail(struct view *view, double zoom, double scale) {
+    /* Decide how much of a view is worth drawing at the size it is shown. Views
+     * made small by zooming out are simplified so that the cost of drawing a
+     * zoomed out desk doesn't grow with the number of surfaces its views have.
+     * Views are never simplified at their natural size or larger. */
+    if (zoom >= 1) {
+	return DETAIL_FULL;
+    }
+    struct wlr_surface *surface = view->surface->surface;
+    double size = fmax(surface->current.width, surface->current.height) * zoom * scale;
+    if (size < wimp.lod_proxy) {
+	return DETAIL_PROXY;
+    }
+    if (size < wimp.lod_thumbnail) {
+	return DETAIL_THUMBNAIL;
+    }
+    return DETAIL_FULL;
+}
+
+
+static void count_surface_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    size_t *n = data;
+    (*n)++;
+}
+
+
+static bool wants_adaptive_sync(struct output *output, bool idle) {
+    /* In auto mode, the refresh rate is left to follow the client while a
+     * fullscreened view is shown, or to fall when nothing is drawn for a while. */
+    switch (output->adaptive_sync) {
+	case ADAPTIVE_SYNC_ON:
+	    return true;
+	case ADAPTIVE_SYNC_AUTO:
+	    if (idle) {
+		return true;
+	    }
+	    struct desk *desk = wimp.current_desk;
+	    if (!desk->fullscreened || wl_list_empty(&desk->views)) {
+		return false;
+	    }
+	    struct view *view = wl_container_of(desk->views.next, view, link);
+	    return view->surface == desk->fullscreened &&
+		view->primary_output == output->wlr_output;
+	default:
+	    return false;
+    }
+}
+
+
+static bool stage_adaptive_sync(struct output *output, bool idle) {
+    /* Add a change of adaptive sync to the output's pending state if its mode
+     * asks for one, so that it is applied along with the next commit. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    if (!output->adaptive_sync_supported || !wlr_output->enabled) {
+	return false;
+    }
+    bool enabled = wants_adaptive_sync(output, idle);
+    if (enabled == (wlr_output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED)) {
+	return false;
+    }
+    wlr_output_enable_adaptive_sync(wlr_output, enabled);
+    return true;
+}
+
+
+static int on_idle_timer(void *data) {
+    /* Nothing has been drawn on the output for a while. */
+    struct output *output = data;
+    struct wlr_output *wlr_output = output->wlr_output;
+    if (!stage_adaptive_sync(output, true)) {
+	return 0;
+    }
+    if (!wlr_output_test(wlr_output) || !wlr_output_commit(wlr_output)) {
+	wlr_output_rollback(wlr_output);
+	wlr_log(WLR_ERROR, "Failed to change adaptive sync on output %s", wlr_output->name);
+    }
+    return 0;
+}
+
+
+static void probe_adaptive_sync(struct output *output) {
+    /* Find out whether the output can do adaptive sync at all. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    if (!wlr_output->enabled || output->adaptive_sync_supported) {
+	return;
+    }
+    wlr_output_enable_adaptive_sync(wlr_output, true);
+    output->adaptive_sync_supported = wlr_output_test(wlr_output);
+    wlr_output_rollback(wlr_output);
+    if (!output->adaptive_sync_supported) {
+	wlr_log(WLR_DEBUG, "Output %s doesn't support adaptive sync", wlr_output->name);
+    }
+}
+
+
+void set_adaptive_sync(struct output *output, enum adaptive_sync mode) {
+    output->adaptive_sync = mode;
+    if (mode != ADAPTIVE_SYNC_AUTO) {
+	wl_event_source_timer_update(output->idle_timer, 0);
+    }
+    wlr_output_damage_add_whole(output->wlr_output_damage);
+}
+
+
+static bool scan_out_fullscreen_view(struct output *output) {
+    /* When a fullscreened view is the only thing shown on an output, try to give
+     * its buffer to the output directly rather than compositing a copy of it. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    struct desk *desk = wimp.current_desk;
+    if (
+	!desk->fullscreened || wl_list_empty(&desk->views) || wimp.can_snap ||
+	(wimp.binding_mode && wimp.binding_mode->show_indicator)
+    ) {
+	return false;
+    }
+
+    // it needs to be on top of the desk
+    struct view *view = wl_container_of(desk->views.next, view, link);
+    if (view->surface != desk->fullscreened || !view->surface->mapped) {
+	return false;
+    }
+
+    // if it hasn't changed since it was last scanned out, there is nothing to do
+    if (output->scanned_out && !pixman_region32_not_empty(&output->wlr_output_damage->current)) {
+	return true;
+    }
+
+    // and nothing can be drawn over it
+    struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, wlr_output);
+    if (!ogeo) {
+	return false;
+    }
+    struct wl_array nodes;
+    wl_array_init(&nodes);
+    scene_collect(output, ogeo, &nodes);
+    struct scene_node *list = nodes.data;
+    int nnodes = nodes.size / sizeof(struct scene_node);
+    bool on_top = nnodes > 0 && list[nnodes - 1].view == view;
+    wl_array_release(&nodes);
+    if (!on_top) {
+	return false;
+    }
+
+    // it must be a single uncropped surface whose buffer fills the output exactly
+    size_t n_surfaces = 0;
+    wlr_xdg_surface_for_each_surface(view->surface, count_surface_iterator, &n_surfaces);
+    struct wlr_surface *surface = view->surface->surface;
+    if (n_surfaces != 1 || surface->buffer == NULL || surface->current.viewport.has_src) {
+	return false;
+    }
+    double scale = wlr_output->scale * desk->zoom;
+    int x = (view_x(view) - ogeo->x / desk->zoom) * scale;
+    int y = (view_y(view) - ogeo->y / desk->zoom) * scale;
+    if (
+	x != 0 || y != 0 ||
+	(int)(surface->current.width * scale) != wlr_output->width ||
+	(int)(surface->current.height * scale) != wlr_output->height ||
+	surface->current.buffer_width != wlr_output->width ||
+	surface->current.buffer_height != wlr_output->height ||
+	surface->current.transform != wlr_output->transform
+    ) {
+	return false;
+    }
+
+    wlr_presentation_surface_sampled_on_output(wimp.presentation, surface, wlr_output);
+    stage_adaptive_sync(output, false);
+    wlr_output_attach_buffer(wlr_output, &surface->buffer->base);
+    if (!wlr_output_test(wlr_output)) {
+	wlr_output_rollback(wlr_output);
+	return false;
+    }
+    return wlr_output_commit(wlr_output);
+}
+
+
+static int refresh_interval(struct output *output) {
+    /* How many milliseconds one refresh of the output takes. */
+    long refresh = output->refresh_nsec;
+    if (refresh <= 0 && output->wlr_output->refresh > 0) {
+	refresh = 1000000000000L / output->wlr_output->refresh;
+    }
+    if (refresh <= 0) {
+	return 16;
+    }
+    int interval = refresh / 1000000;
+    return interval > 0 ? interval : 1;
+}
+
+
+static int on_frozen_frame(void *data) {
+    struct output *output = data;
+    output->frozen_frame_pending = false;
+    if (output->in_transaction) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	scene_send_frame_done(output, &now);
+    }
+    return 0;
+}
+
+
+static void render_output(struct output *output) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
     bool needs_frame;
     pixman_region32_t damage;
     pixman_region32_init(&damage);
 
+    // motion since the last frame moves windows before they are drawn
+    if (wimp.motion_pending) {
+	flush_cursor_motion();
+    }
+
+    // The output shows the last layout until a transaction on it is ready.
+    // Nothing is committed meanwhile, so there are no vblanks to pace clients
+    // by, and they are sent frame callbacks once per refresh instead.
+    if (output->in_transaction) {
+	if (!output->frozen_frame_pending) {
+	    output->frozen_frame_pending = true;
+	    wl_event_source_timer_update(output->frozen_frame_timer, refresh_interval(output));
+	}
+	pixman_region32_fini(&damage);
+	return;
+    }
+
+    if (scan_out_fullscreen_view(output)) {
+	output->scanned_out = true;
+	goto finish;
+    }
+    if (output->scanned_out) {
+	// what was last rendered is out of date with what was scanned out since
+	wlr_output_damage_add_whole(output->wlr_output_damage);
+	output->scanned_out = false;
+    }
+
     if (!wlr_output_damage_attach_render(output->wlr_output_damage, &needs_frame, &damage)) {
 	goto finish;
     }
@@ -130,183 +510,462 @@ static void on_frame(struct wl_listener *listener, void *data) {
 
     struct wlr_renderer *renderer = wimp.renderer;
     struct desk *desk = wimp.current_desk;
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
 
     int width, height;
     double zoom = desk->zoom;
-    wlr_output_effective_resolution(output->wlr_output, &width, &height);
-    wlr_renderer_begin(renderer, width, height);
-    wlr_renderer_clear(renderer, desk->background);
+    struct wlr_output *wlr_output = output->wlr_output;
+    wlr_output_effective_resolution(wlr_output, &width, &height);
+    wlr_renderer_begin(renderer, wlr_output->width, wlr_output->height);
+    snapshot_free_retired();
+
+    if (!pixman_region32_not_empty(&damage)) {
+	goto render_end;
+    }
 
     double ox, oy;
     struct wlr_output_layout_output *ol;
     wl_list_for_each(ol, &wimp.output_layout->outputs, link) {
-	if (ol->output == output->wlr_output) {
+	if (ol->output == wlr_output) {
 	    ox = (double)ol->x;
 	    oy = (double)ol->y;
 	    break;
 	}
     }
 
-    // paint wallpaper
+    // Collect everything to be drawn from the bottom up, fetching only the
+    // clients under the damage from the desk's grid, and place it on the output.
+    struct wl_array items;
+    wl_array_init(&items);
+    pixman_box32_t *extents = pixman_region32_extents(&damage);
+    double scale = wlr_output->scale;
+    struct wlr_box area = {
+	.x = floor(ox + extents->x1 / scale),
+	.y = floor(oy + extents->y1 / scale),
+	.width = ceil((extents->x2 - extents->x1) / scale),
+	.height = ceil((extents->y2 - extents->y1) / scale),
+    };
+    scene_collect(output, &area, &items);
+
+    struct scene_node *list = items.data;
+    int nitems = items.size / sizeof(struct scene_node);
+    int views_start = nitems, scratchpads_start = nitems, layers_start = nitems;
+    for (int i = nitems - 1; i >= 0; i--) {
+	list[i].x = (int)(list[i].x - ox / list[i].zoom);
+	list[i].y = (int)(list[i].y - oy / list[i].zoom);
+	if (list[i].layer == SCENE_VIEWS) {
+	    list[i].detail = view_detail(list[i].view, list[i].zoom, scale);
+	}
+	if (list[i].layer >= SCENE_VIEWS) {
+	    views_start = i;
+	}
+	if (list[i].layer >= SCENE_SCRATCHPADS) {
+	    scratchpads_start = i;
+	}
+	if (list[i].layer >= SCENE_TOP) {
+	    layers_start = i;
+	}
+    }
+
+    // Clip everything to what isn't hidden by opaque surfaces above it, leaving
+    // the background showing only where nothing opaque covers it.
+    pixman_region32_t background;
+    pixman_region32_init(&background);
+    occlude_items(wlr_output, &items, &damage, &background);
+    pixman_region32_subtract(&background, &damage, &background);
+
+    // paint background colour, unless an opaque wallpaper will cover it anyway
     struct wallpaper *wallpaper = desk->wallpaper;
-    if (wallpaper != NULL) {
-	int wh = wallpaper->height;
-	int ww = wallpaper->width;
-	float mat[9];
-	memcpy(mat, output->wlr_output->transform_matrix, 9 * sizeof(float));
-	wlr_matrix_scale(mat, zoom, zoom);
-	for (int x = ((int)desk->panned_x % ww) - ww; x < width / zoom; x += ww) {
-	    for (int y = ((int)desk->panned_y % wh) - wh; y < height / zoom; y += wh) {
-		wlr_render_texture(renderer, wallpaper->texture, mat, x, y, 1.0f);
-	    }
+    int nrects;
+    pixman_box32_t *rects;
+    if (wallpaper == NULL || !wlr_texture_is_opaque(wallpaper->texture)) {
+	rects = pixman_region32_rectangles(&background, &nrects);
+	for (int i = 0; i < nrects; i++) {
+	    scissor_output(wlr_output, &rects[i]);
+	    wlr_renderer_clear(renderer, desk->background);
 	}
     }
 
+    // paint wallpaper over the visible background
+    if (wallpaper != NULL && pixman_region32_not_empty(&background)) {
+	double tile_scale = zoom * wlr_output->scale;
+	wallpaper_render(
+	    wallpaper, wlr_output, &background,
+	    (int)desk->panned_x % wallpaper->width * tile_scale,
+	    (int)desk->panned_y % wallpaper->height * tile_scale, tile_scale
+	);
+    }
+    pixman_region32_fini(&background);
+
     struct render_data rdata = {
-	.output = output->wlr_output,
+	.output = wlr_output,
 	.renderer = renderer,
-	.bordered = NULL,
-	.when = &now,
+	.damage = &damage,
 	.zoom = 1,
-	.is_focussed = false,
 	.x = 0,
 	.y = 0,
     };
 
     // paint background and bottom layers
-    struct layer_view *lview;
-    wl_list_for_each(lview, &output->layer_views[ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND], link) {
-	wlr_surface_for_each_surface(
-	    lview->surface->surface, render_surface, &rdata
-	);
-    }
-    wl_list_for_each(lview, &output->layer_views[ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM], link) {
-	wlr_surface_for_each_surface(
-	    lview->surface->surface, render_surface, &rdata
-	);
-    }
-
-    rdata.zoom = zoom;
+    render_items(&rdata, list, 0, views_start);
 
-    // paint clients
+    // paint clients and then scratchpads, each with their borders
     struct view *view;
+    struct border_batch borders;
     struct wlr_surface *focussed = wimp.seat->keyboard_state.focused_surface;
-    int border_width = wimp.current_desk->border_width;
-    wl_list_for_each_reverse(view, &desk->views, link) {
-	rdata.x = view->x - ox / zoom;
-	rdata.y = view->y - oy / zoom;
-	if (
-		(rdata.x + view->surface->geometry.width + border_width < 0) ||
-		(rdata.y + view->surface->geometry.height + border_width < 0) ||
-		(rdata.x - border_width > width / zoom) || (rdata.y - border_width > height / zoom)
-	) {
-	    continue;
-	}
-	rdata.is_focussed = (view->surface->surface == focussed);
-	rdata.bordered = view->surface->surface;
-	wlr_xdg_surface_for_each_surface(view->surface, render_surface, &rdata);
-    }
-
-    rdata.zoom = 1;
-
-    struct scratchpad *scratchpad;
-    wl_list_for_each(scratchpad, &wimp.scratchpads, link) {
-	if (scratchpad->is_mapped) {
-	    view = scratchpad->view;
-	    rdata.x = view->x;
-	    rdata.y = view->y;
-	    rdata.is_focussed = (view->surface->surface == focussed);
-	    rdata.bordered = view->surface->surface;
-	    wlr_xdg_surface_for_each_surface(view->surface, render_surface, &rdata);
+    int starts[] = { views_start, scratchpads_start, layers_start };
+    for (int s = 0; s < 2; s++) {
+	border_batch_init(&borders, wlr_output);
+	for (int i = starts[s + 1] - 1; i >= starts[s]; i--) {
+	    view = list[i].view;
+	    bool is_focussed = view->surface->surface == focussed;
+	    if (list[i].detail == DETAIL_PROXY) {
+		border_batch_add_proxy(
+		    &borders, view, list[i].x, list[i].y, list[i].zoom, is_focussed
+		);
+	    } else {
+		border_batch_add_view(
+		    &borders, view, list[i].x, list[i].y, list[i].zoom,
+		    is_focussed, list[i].detail == DETAIL_FULL
+		);
+	    }
 	}
+	render_items(&rdata, list, starts[s], starts[s + 1]);
+	border_batch_flush(&borders, &damage);
     }
 
-    rdata.bordered = NULL;
-    rdata.is_focussed = false;
-
     // paint top and overlay layers
-    wl_list_for_each(lview, &output->layer_views[ZWLR_LAYER_SHELL_V1_LAYER_TOP], link) {
-	rdata.x = lview->geo.x;
-	rdata.y = lview->geo.y;
-	wlr_surface_for_each_surface(
-	    lview->surface->surface, render_surface, &rdata
-	);
-    }
-    wl_list_for_each(lview, &output->layer_views[ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY], link) {
-	rdata.x = lview->geo.x;
-	rdata.y = lview->geo.y;
-	wlr_surface_for_each_surface(
-	    lview->surface->surface, render_surface, &rdata
-	);
-    }
+    render_items(&rdata, list, layers_start, nitems);
+
+    wl_array_release(&items);
 
     // paint mark indicator
-    if (wimp.mark_waiting) {
+    if (wimp.binding_mode && wimp.binding_mode->show_indicator) {
 	struct wlr_box indicator = wimp.mark_indicator.box;
 	indicator.y = height - indicator.height;
-	wlr_render_rect(
-	    renderer, &indicator, wimp.mark_indicator.colour,
-	    output->wlr_output->transform_matrix
-	);
+	scale_box(&indicator, wlr_output->scale);
+	render_rect(wlr_output, &damage, &indicator, wimp.mark_indicator.colour);
     }
 
     // paint snap box
     if (wimp.can_snap) {
-	wlr_render_rect(
-	    renderer, &wimp.snap_geobox, wimp.snapbox_colour,
-	    output->wlr_output->transform_matrix
-	);
+	struct wlr_box snap_box = wimp.snap_geobox;
+	snap_box.x -= ox;
+	snap_box.y -= oy;
+	scale_box(&snap_box, wlr_output->scale);
+	render_rect(wlr_output, &damage, &snap_box, wimp.snapbox_colour);
     }
 
-    wlr_output_render_software_cursors(output->wlr_output, NULL);  // no-op with HW cursors
+render_end:
+    wlr_renderer_scissor(renderer, NULL);
+    wlr_output_render_software_cursors(wlr_output, &damage);  // no-op with HW cursors
     wlr_renderer_end(renderer);
-    wlr_output_commit(output->wlr_output);
+
+    // only the damaged parts of the buffer need to be presented
+    int buffer_width, buffer_height;
+    wlr_output_transformed_resolution(wlr_output, &buffer_width, &buffer_height);
+    pixman_region32_t frame_damage;
+    pixman_region32_init(&frame_damage);
+    enum wl_output_transform transform = wlr_output_transform_invert(wlr_output->transform);
+    wlr_region_transform(
+	&frame_damage, &output->wlr_output_damage->current,
+	transform, buffer_width, buffer_height
+    );
+    wlr_output_set_damage(wlr_output, &frame_damage);
+    pixman_region32_fini(&frame_damage);
+    stage_adaptive_sync(output, false);
+    wlr_output_commit(wlr_output);
+    if (output->adaptive_sync == ADAPTIVE_SYNC_AUTO) {
+	wl_event_source_timer_update(output->idle_timer, ADAPTIVE_SYNC_IDLE);
+    }
+
+    // remember how long that took to schedule the next frame
+    struct timespec done;
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    output->render_times[output->render_time_index] =
+	(done.tv_sec - now.tv_sec) * 1000000000L + done.tv_nsec - now.tv_nsec;
+    output->render_time_index = (output->render_time_index + 1) % RENDER_TIMES;
 
 finish:
     pixman_region32_fini(&damage);
+    scene_send_frame_done(output, &now);
 }
 
 
-void damage_box(struct wlr_box *geo, bool add_borders) {
-    struct output *output;
+void present_now(struct output *output) {
+    /* A fullscreened view that allows tearing has a new buffer. If it can be
+     * scanned out, hand it to the output right away rather than waiting for
+     * the repaint that was scheduled for it. Its client still gets frame
+     * callbacks from the output's next frame, as usual. */
+    if (
+	output->wlr_output->frame_pending || output->in_transaction ||
+	!scan_out_fullscreen_view(output)
+    ) {
+	return;
+    }
+    output->scanned_out = true;
+    wl_event_source_timer_update(output->repaint_timer, 0);
+}
 
-    if (add_borders) {
-	struct wlr_box damaged;
-	int border_width = wimp.current_desk->border_width;
-	memcpy(&damaged, geo, sizeof(struct wlr_box));
-	damaged.x -= border_width;
-	damaged.y -= border_width;
-	damaged.width += border_width * 2;
-	damaged.height += border_width * 2;
-	wl_list_for_each(output, &wimp.outputs, link) {
-	    wlr_output_damage_add_box(output->wlr_output_damage, &damaged);
+
+static int frame_delay(struct output *output) {
+    /* Find how many milliseconds drawing the next frame can wait so that it is
+     * finished just in time for the next vblank, leaving max_render_time or the
+     * longest recent render time, whichever is longer, to draw it. With
+     * adaptive sync there is no fixed vblank to wait for. */
+    if (
+	!wimp.max_render_time ||
+	output->wlr_output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED
+    ) {
+	return 0;
+    }
+
+    long refresh = output->refresh_nsec;
+    if (refresh <= 0 && output->wlr_output->refresh > 0) {
+	refresh = 1000000000000L / output->wlr_output->refresh;
+    }
+    if (refresh <= 0) {
+	return 0;
+    }
+
+    long budget = wimp.max_render_time * 1000000L;
+    for (int i = 0; i < RENDER_TIMES; i++) {
+	if (output->render_times[i] > budget) {
+	    budget = output->render_times[i];
 	}
+    }
+
+    struct timespec now;
+    clock_gettime(wlr_backend_get_presentation_clock(wimp.backend), &now);
+    struct timespec *last = &output->last_presentation;
+    long until_vblank = (last->tv_sec - now.tv_sec) * 1000000000L +
+	last->tv_nsec - now.tv_nsec + refresh;
+    long delay = (until_vblank - budget) / 1000000;
+    return delay > 0 ? delay : 0;
+}
+
+
+static int on_repaint_timer(void *data) {
+    render_output(data);
+    return 0;
+}
+
+
+static void on_frame(struct wl_listener *listener, void *data) {
+    /* Outputs are scheduled independently so that each is drawn close to its own
+     * vblank, keeping input latency low. */
+    struct output *output = wl_container_of(listener, output, frame_listener);
+    int delay = frame_delay(output);
+    if (delay < 1) {
+	render_output(output);
     } else {
-	wl_list_for_each(output, &wimp.outputs, link) {
-	    wlr_output_damage_add_box(output->wlr_output_damage, geo);
+	wl_event_source_timer_update(output->repaint_timer, delay);
+    }
+}
+
+
+static void on_present(struct wl_listener *listener, void *data) {
+    struct output *output = wl_container_of(listener, output, present_listener);
+    struct wlr_output_event_present *event = data;
+    if (event->when) {
+	output->last_presentation = *event->when;
+	output->refresh_nsec = event->refresh;
+    }
+}
+
+
+static void damage_layout_area(double x, double y, double width, double height) {
+    /* Damage an area given in layout coordinates on only those outputs that it
+     * intersects, converted into each output's local, scaled coordinates. */
+    struct output *output;
+    wl_list_for_each(output, &wimp.outputs, link) {
+	struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, output->wlr_output);
+	if (!ogeo) {
+	    continue;
 	}
+	double scale = output->wlr_output->scale;
+	int x1 = fmax(floor((x - ogeo->x) * scale), 0);
+	int y1 = fmax(floor((y - ogeo->y) * scale), 0);
+	int x2 = fmin(ceil((x + width - ogeo->x) * scale), ceil(ogeo->width * scale));
+	int y2 = fmin(ceil((y + height - ogeo->y) * scale), ceil(ogeo->height * scale));
+	if (x2 <= x1 || y2 <= y1) {
+	    continue;
+	}
+	struct wlr_box box = {
+	    .x = x1,
+	    .y = y1,
+	    .width = x2 - x1,
+	    .height = y2 - y1,
+	};
+	wlr_output_damage_add_box(output->wlr_output_damage, &box);
     }
 }
 
 
+void damage_box(struct wlr_box *geo, bool add_borders) {
+    /* geo is in layout coordinates. Borders are scaled by the desk's zoom. */
+    if (add_borders) {
+	double border_width = ceil(wimp.current_desk->border_width * wimp.current_desk->zoom);
+	damage_layout_area(
+	    geo->x - border_width, geo->y - border_width,
+	    geo->width + border_width * 2, geo->height + border_width * 2
+	);
+    } else {
+	damage_layout_area(geo->x, geo->y, geo->width, geo->height);
+    }
+}
+
+
+struct damage_data {
+    double x, y;
+    double zoom;
+};
+
+
+static void damage_surface_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    struct damage_data *ddata = data;
+    damage_layout_area(
+	ddata->x + sx * ddata->zoom, ddata->y + sy * ddata->zoom,
+	surface->current.width * ddata->zoom, surface->current.height * ddata->zoom
+    );
+}
+
+
 void damage_by_view(struct view *view, bool with_borders) {
-    double zoom = wimp.current_desk->zoom;
+    /* Damage every surface belonging to the view where it is drawn in the
+     * layout, optionally including its borders. Scratchpads are not zoomed. */
+    struct damage_data ddata = {
+	.x = view_x(view),
+	.y = view_y(view),
+	.zoom = 1,
+    };
+    if (!view->is_scratchpad) {
+	ddata.zoom = wimp.current_desk->zoom;
+	ddata.x *= ddata.zoom;
+	ddata.y *= ddata.zoom;
+    }
+    wlr_xdg_surface_for_each_surface(view->surface, damage_surface_iterator, &ddata);
+
+    if (with_borders) {
+	double border_width = ceil(wimp.current_desk->border_width * ddata.zoom);
+	damage_layout_area(
+	    ddata.x - border_width, ddata.y - border_width,
+	    view->surface->surface->current.width * ddata.zoom + border_width * 2,
+	    view->surface->surface->current.height * ddata.zoom + border_width * 2
+	);
+    }
+}
+
+
+void damage_view_borders(struct view *view) {
+    /* Damage only the ring of borders around a view, e.g. when they change colour. */
+    double zoom = view->is_scratchpad ? 1 : wimp.current_desk->zoom;
+    double border_width = ceil(wimp.current_desk->border_width * zoom);
+    if (border_width <= 0) {
+	return;
+    }
+    double x = view_x(view) * zoom;
+    double y = view_y(view) * zoom;
+    double width = view->surface->surface->current.width * zoom;
+    double height = view->surface->surface->current.height * zoom;
+
+    damage_layout_area(x - border_width, y - border_width, width + border_width * 2, border_width);
+    damage_layout_area(x - border_width, y + height, width + border_width * 2, border_width);
+    damage_layout_area(x - border_width, y, border_width, height);
+    damage_layout_area(x + width, y, border_width, height);
+}
 
-    struct wlr_box geo = {
-	.x = view->x,
-	.y = view->y,
-	.width = view->width * zoom,
-	.height = view->height * zoom,
+
+static void damage_surface_region(
+    struct output *output, struct wlr_surface *surface, double x, double y, double zoom
+) {
+    /* Add a surface's committed damage to an output. x and y are the surface's
+     * position in output-local layout coordinates. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    double scale = wlr_output->scale * zoom;
+    struct wlr_box box = {
+	.x = floor(x * wlr_output->scale),
+	.y = floor(y * wlr_output->scale),
+	.width = ceil(surface->current.width * scale),
+	.height = ceil(surface->current.height * scale),
+    };
+    int width, height;
+    wlr_output_transformed_resolution(wlr_output, &width, &height);
+    struct wlr_box output_box = {
+	.x = 0,
+	.y = 0,
+	.width = width,
+	.height = height,
     };
+    struct wlr_box intersection;
+    if (!wlr_box_intersection(&intersection, &box, &output_box)) {
+	return;
+    }
 
-    damage_box(&geo, with_borders);
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+    wlr_surface_get_effective_damage(surface, &damage);
+    wlr_region_scale(&damage, &damage, scale);
+    if (scale != floor(scale) || ceil(scale) > surface->current.scale) {
+	// filtering can bleed into neighbouring pixels when the surface is scaled
+	wlr_region_expand(&damage, &damage, fmax(ceil(scale) - surface->current.scale, 1));
+    }
+    pixman_region32_translate(&damage, box.x, box.y);
+    wlr_output_damage_add(output->wlr_output_damage, &damage);
+    pixman_region32_fini(&damage);
+}
+
+
+static void damage_view_surface_iterator(
+    struct wlr_surface *surface, int sx, int sy, void *data
+) {
+    struct view *view = data;
+    double zoom = view->is_scratchpad ? 1 : wimp.current_desk->zoom;
+
+    struct output *output;
+    wl_list_for_each(output, &wimp.outputs, link) {
+	struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, output->wlr_output);
+	if (!ogeo) {
+	    continue;
+	}
+	damage_surface_region(
+	    output, surface,
+	    (view_x(view) + sx) * zoom - ogeo->x, (view_y(view) + sy) * zoom - ogeo->y, zoom
+	);
+    }
+}
+
+
+void damage_view_surfaces(struct view *view) {
+    /* Damage only the parts of a view's surfaces that the client reported as
+     * changed in their latest commits. */
+    wlr_xdg_surface_for_each_surface(view->surface, damage_view_surface_iterator, view);
+}
+
+
+static void damage_lview_surface_iterator(
+    struct wlr_surface *surface, int sx, int sy, void *data
+) {
+    struct layer_view *lview = data;
+    damage_surface_region(lview->output, surface, lview->geo.x + sx, lview->geo.y + sy, 1);
+}
+
+
+void damage_lview_surfaces(struct layer_view *lview) {
+    wlr_surface_for_each_surface(lview->surface->surface, damage_lview_surface_iterator, lview);
 }
 
 
 void damage_by_lview(struct layer_view *lview) {
-    damage_box(&lview->geo, false);
+    /* Layer views are positioned in their output's local coordinates. */
+    struct wlr_output *wlr_output = lview->output->wlr_output;
+    double scale = wlr_output->scale;
+    struct wlr_box box = {
+	.x = floor(lview->geo.x * scale),
+	.y = floor(lview->geo.y * scale),
+	.width = ceil(lview->geo.width * scale),
+	.height = ceil(lview->geo.height * scale),
+    };
+    wlr_output_damage_add_box(lview->output->wlr_output_damage, &box);
 }
 
 
@@ -339,6 +998,7 @@ void damage_mark_indicator() {
 	    .width = indicator.width,
 	    .height = indicator.height,
 	};
+	scale_box(&geo, output->wlr_output->scale);
 	wlr_output_damage_add_box(output->wlr_output_damage, &geo);
     }
 }
@@ -358,7 +1018,14 @@ static void on_destroy(struct wl_listener *listener, void *data) {
         };
     }
 
+    // views that were shown on it are shown elsewhere or not at all now
+    scene_remove_output(output->wlr_output);
+
+    wl_event_source_remove(output->repaint_timer);
+    wl_event_source_remove(output->frozen_frame_timer);
+    wl_event_source_remove(output->idle_timer);
     wl_list_remove(&output->frame_listener.link);
+    wl_list_remove(&output->present_listener.link);
     wl_list_remove(&output->destroy_listener.link);
     wl_list_remove(&output->link);
     free(output);
@@ -382,9 +1049,19 @@ static void on_new_output(struct wl_listener *listener, void *data) {
     wlr_output->data = output;
     output->wlr_output_damage = wlr_output_damage_create(wlr_output);
 
+    probe_adaptive_sync(output);
+
+    struct wl_event_loop *event_loop = wl_display_get_event_loop(wimp.display);
+    output->repaint_timer = wl_event_loop_add_timer(event_loop, on_repaint_timer, output);
+    output->frozen_frame_timer = wl_event_loop_add_timer(event_loop, on_frozen_frame, output);
+    output->idle_timer = wl_event_loop_add_timer(event_loop, on_idle_timer, output);
+    set_adaptive_sync(output, wimp.adaptive_sync);
+
     output->frame_listener.notify = on_frame;
+    output->present_listener.notify = on_present;
     output->destroy_listener.notify = on_destroy;
     wl_signal_add(&output->wlr_output_damage->events.frame, &output->frame_listener);
+    wl_signal_add(&wlr_output->events.present, &output->present_listener);
     wl_signal_add(&wlr_output->events.destroy, &output->destroy_listener);
 
     wl_list_insert(&wimp.outputs, &output->link);
@@ -424,6 +1101,9 @@ static void output_manager_reconfigure(
 	    );
             wlr_output_set_transform(wlr_output, config_head->state.transform);
             wlr_output_set_scale(wlr_output, config_head->state.scale);
+
+	    // the head state doesn't carry adaptive sync, so keep the output's own
+	    stage_adaptive_sync(wlr_output->data, false);
         }
 
         ok = wlr_output_test(wlr_output);
@@ -435,6 +1115,7 @@ static void output_manager_reconfigure(
     wl_list_for_each(config_head, &config->heads, link) {
         if (ok && commit) {
             wlr_output_commit(config_head->state.output);
+	    probe_adaptive_sync(config_head->state.output->data);
 	} else {
             wlr_output_rollback(config_head->state.output);
 	}
@@ -475,6 +1156,11 @@ static void on_output_layout_change(struct wl_listener *listener, void *data) {
     }
 
     wlr_output_manager_v1_set_configuration(wimp.output_manager, config);
+
+    scene_changed();
+    if (wimp.current_desk) {
+	wimp.current_desk->outputs_dirty = true;
+    }
 }
 
 
@@ -6,9 +6,14 @@
 void set_up_outputs();
 void damage_box(struct wlr_box *geo, bool add_borders);
 void damage_by_view(struct view *view, bool with_borders);
+void damage_view_borders(struct view *view);
+void damage_view_surfaces(struct view *view);
 void damage_by_lview(struct layer_view *lview);
+void damage_lview_surfaces(struct layer_view *lview);
 void damage_all_outputs();
 void damage_all_views();
 void damage_mark_indicator();
+void set_adaptive_sync(struct output *output, enum adaptive_sync mode);
+void present_now(struct output *output);
 
 #endif
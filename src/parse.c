@@ -92,13 +92,24 @@ bool str_handler(void **data, char *args) {
 	*data = calloc(1, sizeof(double));
 	*(double *)(*data) = strtod(args, NULL);
     } else {
-	*data = calloc(strlen(args), sizeof(char));
+	*data = calloc(strlen(args) + 1, sizeof(char));
 	strncpy(*data, args, strlen(args));
     }
     return true;
 }
 
 
+bool name_handler(void **data, char *args) {
+    /* Names are always kept as strings, so they can't be numbers. */
+    char *name = args ? strtok(args, " \t\n\r") : NULL;
+    if (!name || is_number(name)) {
+	return false;
+    }
+    *data = strdup(name);
+    return true;
+}
+
+
 bool motion_handler(void **data, char *args) {
     char *s;
     if (!args) {
@@ -8,6 +8,7 @@ int _get(struct dict *values, const int len, const char *name);
 
 bool dir_handler(void **data, char *args);
 bool str_handler(void **data, char *args);
+bool name_handler(void **data, char *args);
 bool motion_handler(void **data, char *args);
 bool scratchpad_handler(void **data, char *args);
 bool box_handler(void **data, char *args);
@@ -0,0 +1,533 @@
+#include <math.h>
+#include <time.h>
+#include <wlr/types/wlr_layer_shell_v1.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_presentation_time.h>
+
+#include "desk.h"
+#include "fractional_scale.h"
+#include "grid.h"
+#include "output.h"
+#include "scene.h"
+#include "types.h"
+
+
+/* The scene is everything that is shown, stacked from the bottom up:
+ *
+ *   background layer -> bottom layer -> current desk's views -> scratchpads ->
+ *   top layer -> overlay layer
+ *
+ * This is not a retained scene tree. There are no persistent nodes: the lists
+ * that already own each kind of object (every output's layer views, each
+ * desk's views and grid, and the scratchpads) are flattened by scene_collect
+ * into a fresh array of nodes whenever drawing, scanout, hit-testing or frame
+ * callbacks need to know what is shown where. Callers that move, map or
+ * restack views, or pan and zoom a desk, still change the objects themselves
+ * and then report it here with scene_update_view, scene_update_camera and
+ * friends, which keep the grid and output enter/leave up to date. Damage is
+ * still added by those callers rather than worked out from the scene. */
+
+
+static void canvas_area(
+    struct desk *desk, double x, double y, double width, double height, struct wlr_box *area
+) {
+    /* Find the area of a desk's canvas that is shown in an area of the layout. */
+    area->x = floor(x / desk->zoom - desk->panned_x);
+    area->y = floor(y / desk->zoom - desk->panned_y);
+    area->width = ceil(width / desk->zoom) + 2;
+    area->height = ceil(height / desk->zoom) + 2;
+}
+
+
+static void add_node(
+    struct wl_array *nodes, enum scene_layer layer, struct view *view,
+    struct layer_view *lview, double x, double y, double zoom
+) {
+    struct scene_node *node = wl_array_add(nodes, sizeof(struct scene_node));
+    node->layer = layer;
+    node->detail = DETAIL_FULL;
+    node->view = view;
+    node->lview = lview;
+    node->x = x;
+    node->y = y;
+    node->zoom = zoom;
+}
+
+
+static void collect_layer(
+    struct wl_array *nodes, struct output *output, enum scene_layer layer, uint32_t shell_layer
+) {
+    struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, output->wlr_output);
+    struct layer_view *lview;
+    wl_list_for_each(lview, &output->layer_views[shell_layer], link) {
+	if (lview->surface->mapped) {
+	    add_node(nodes, layer, NULL, lview, ogeo->x + lview->geo.x, ogeo->y + lview->geo.y, 1);
+	}
+    }
+}
+
+
+static void collect_views(struct wl_array *nodes, struct wlr_box *area) {
+    struct desk *desk = wimp.current_desk;
+    struct wlr_box canvas;
+    canvas_area(desk, area->x, area->y, area->width, area->height, &canvas);
+
+    struct wl_array views;
+    wl_array_init(&views);
+    grid_query(desk, &canvas, &views);
+    struct view **found = views.data;
+    int nfound = views.size / sizeof(struct view *);
+
+    for (int i = nfound - 1; i >= 0; i--) {
+	add_node(nodes, SCENE_VIEWS, found[i], NULL, view_x(found[i]), view_y(found[i]), desk->zoom);
+    }
+
+    // Only the top view can have popups extending past its own box, so it is
+    // always included.
+    if (!wl_list_empty(&desk->views)) {
+	struct view *top = wl_container_of(desk->views.next, top, link);
+	if (top->surface->mapped && (nfound == 0 || found[0] != top)) {
+	    add_node(nodes, SCENE_VIEWS, top, NULL, view_x(top), view_y(top), desk->zoom);
+	}
+    }
+    wl_array_release(&views);
+}
+
+
+void scene_collect(struct output *output, struct wlr_box *area, struct wl_array *nodes) {
+    /* Fill nodes with everything shown on the output, from the bottom up. Views
+     * on the desk are only included if they are in area, in layout coordinates.
+     * Layer views and scratchpads are few, and are always included. */
+    collect_layer(nodes, output, SCENE_BACKGROUND, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND);
+    collect_layer(nodes, output, SCENE_BOTTOM, ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM);
+    collect_views(nodes, area);
+
+    struct scratchpad *scratchpad;
+    wl_list_for_each(scratchpad, &wimp.scratchpads, link) {
+	if (scratchpad->is_mapped) {
+	    struct view *view = scratchpad->view;
+	    add_node(nodes, SCENE_SCRATCHPADS, view, NULL, view->x, view->y, 1);
+	}
+    }
+
+    collect_layer(nodes, output, SCENE_TOP, ZWLR_LAYER_SHELL_V1_LAYER_TOP);
+    collect_layer(nodes, output, SCENE_OVERLAY, ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY);
+}
+
+
+void scene_node_for_each_surface(
+    struct scene_node *node, wlr_surface_iterator_func_t iterator, void *data
+) {
+    if (node->view) {
+	wlr_xdg_surface_for_each_surface(node->view->surface, iterator, data);
+    } else {
+	wlr_layer_surface_v1_for_each_surface(node->lview->surface, iterator, data);
+    }
+}
+
+
+/* The last hit test is kept until the scene changes, so that asking again what
+ * is under the pointer before it moves costs nothing. */
+static struct {
+    bool valid;
+    unsigned int generation;
+    double lx, ly;
+    bool hit;
+    struct scene_node node;
+    struct wlr_surface *surface;
+    double sx, sy;
+    struct wl_listener surface_destroy_listener;
+} last_hit;
+
+
+void scene_changed() {
+    /* Something was mapped, unmapped, moved, resized, restacked or committed, or
+     * the camera, desk or layers changed. */
+    wimp.scene_generation++;
+}
+
+
+static void on_hit_surface_destroy(struct wl_listener *listener, void *data) {
+    last_hit.valid = false;
+    wl_list_remove(&last_hit.surface_destroy_listener.link);
+    wl_list_init(&last_hit.surface_destroy_listener.link);
+}
+
+
+static bool find_node_at(
+    double lx, double ly, struct scene_node *found,
+    struct wlr_surface **surface, double *sx, double *sy
+) {
+    *surface = NULL;
+    struct wlr_output *wlr_output = wlr_output_layout_output_at(wimp.output_layout, lx, ly);
+    if (!wlr_output) {
+	return false;
+    }
+
+    struct wlr_box point = {
+	.x = floor(lx),
+	.y = floor(ly),
+	.width = 1,
+	.height = 1,
+    };
+    struct wl_array nodes;
+    wl_array_init(&nodes);
+    scene_collect(wlr_output->data, &point, &nodes);
+
+    bool hit = false;
+    int border_width = wimp.current_desk->border_width;
+    struct scene_node *list = nodes.data;
+    for (int i = nodes.size / sizeof(struct scene_node) - 1; i >= 0 && !hit; i--) {
+	struct scene_node *node = &list[i];
+	double x = lx / node->zoom - node->x;
+	double y = ly / node->zoom - node->y;
+	double tsx = 0, tsy = 0;
+
+	if (node->lview) {
+	    *surface = wlr_layer_surface_v1_surface_at(node->lview->surface, x, y, &tsx, &tsy);
+	} else {
+	    *surface = wlr_xdg_surface_surface_at(node->view->surface, x, y, &tsx, &tsy);
+	}
+
+	// borders of views on the desk can be grabbed too
+	if (!*surface && node->layer == SCENE_VIEWS && border_width) {
+	    struct wlr_box bordered = {
+		.x = -border_width,
+		.y = -border_width,
+		.width = node->view->surface->geometry.width + border_width * 2,
+		.height = node->view->surface->geometry.height + border_width * 2,
+	    };
+	    if (wlr_box_contains_point(&bordered, x, y)) {
+		*surface = node->view->surface->surface;
+	    }
+	}
+
+	if (*surface) {
+	    *sx = tsx;
+	    *sy = tsy;
+	    *found = *node;
+	    hit = true;
+	}
+    }
+
+    wl_array_release(&nodes);
+    return hit;
+}
+
+
+bool scene_node_at(
+    double lx, double ly, struct scene_node *found,
+    struct wlr_surface **surface, double *sx, double *sy
+) {
+    /* Find the top-most node at a point in the layout, and the surface within it
+     * that is under the point. */
+    if (
+	!last_hit.valid || last_hit.generation != wimp.scene_generation ||
+	last_hit.lx != lx || last_hit.ly != ly
+    ) {
+	wl_list_remove(&last_hit.surface_destroy_listener.link);
+	wl_list_init(&last_hit.surface_destroy_listener.link);
+	last_hit.hit = find_node_at(
+	    lx, ly, &last_hit.node, &last_hit.surface, &last_hit.sx, &last_hit.sy
+	);
+	if (last_hit.surface) {
+	    wl_signal_add(&last_hit.surface->events.destroy, &last_hit.surface_destroy_listener);
+	}
+	last_hit.valid = true;
+	last_hit.generation = wimp.scene_generation;
+	last_hit.lx = lx;
+	last_hit.ly = ly;
+    }
+
+    *surface = last_hit.surface;
+    if (last_hit.hit) {
+	*found = last_hit.node;
+	*sx = last_hit.sx;
+	*sy = last_hit.sy;
+    }
+    return last_hit.hit;
+}
+
+
+static void view_layout_box(struct view *view, struct wlr_box *box) {
+    double zoom = view->is_scratchpad ? 1 : view->desk->zoom;
+    box->x = floor(view_x(view) * zoom);
+    box->y = floor(view_y(view) * zoom);
+    box->width = ceil(view->surface->surface->current.width * zoom);
+    box->height = ceil(view->surface->surface->current.height * zoom);
+}
+
+
+struct output_data {
+    struct wlr_output *wlr_output;
+    bool enter;
+};
+
+
+static void output_surface_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    struct output_data *odata = data;
+    if (odata->enter) {
+	wlr_surface_send_enter(surface, odata->wlr_output);
+    } else {
+	wlr_surface_send_leave(surface, odata->wlr_output);
+    }
+}
+
+
+static void update_view_outputs(struct view *view, bool shown) {
+    /* Tell a view's surfaces which outputs they are shown on, and pick the one
+     * that drives its frame callbacks: the fastest, or where more of it is shown
+     * if they are as fast, so that it draws once per refresh of that output
+     * however many it straddles. */
+    struct wlr_box box, intersection;
+    if (shown) {
+	view_layout_box(view, &box);
+    }
+
+    struct wlr_output *old_primary = view->primary_output;
+    view->primary_output = NULL;
+    int primary_refresh = 0, primary_area = 0;
+    struct output *output;
+    wl_list_for_each(output, &wimp.outputs, link) {
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, wlr_output);
+	struct output_data odata = {
+	    .wlr_output = wlr_output,
+	    .enter = shown && ogeo && wlr_box_intersection(&intersection, &box, ogeo),
+	};
+	wlr_xdg_surface_for_each_surface(view->surface, output_surface_iterator, &odata);
+
+	int area = intersection.width * intersection.height;
+	if (odata.enter && (
+	    !view->primary_output || wlr_output->refresh > primary_refresh ||
+	    (wlr_output->refresh == primary_refresh && area > primary_area)
+	)) {
+	    view->primary_output = wlr_output;
+	    primary_refresh = wlr_output->refresh;
+	    primary_area = area;
+	}
+    }
+
+    // clients are asked to draw at the scale of their primary output
+    if (view->primary_output != old_primary) {
+	fractional_scale_schedule();
+    }
+}
+
+
+static uint32_t mix(uint32_t hash, uint32_t value) {
+    return (hash ^ value) * 16777619u;
+}
+
+
+static uint32_t subsurface_shape(uint32_t hash, struct wl_list *subsurfaces) {
+    struct wlr_subsurface *subsurface;
+    wl_list_for_each(subsurface, subsurfaces, parent_link) {
+	hash = mix(hash, (uintptr_t)subsurface);
+	hash = mix(hash, subsurface->mapped);
+	hash = mix(hash, subsurface->current.x);
+	hash = mix(hash, subsurface->current.y);
+	hash = mix(hash, subsurface->surface->current.width);
+	hash = mix(hash, subsurface->surface->current.height);
+    }
+    return hash;
+}
+
+
+void scene_surface_committed(struct wlr_surface *surface, int x, int y, uint32_t *shape) {
+    /* A surface at x, y relative to its parent committed. Most commits only
+     * bring a new buffer, which doesn't change what is under the pointer, so
+     * the scene only counts as changed if the surface's size, position, input
+     * region or direct subsurfaces did. shape holds a hash of these from the
+     * surface's last commit. */
+    uint32_t hash = 2166136261u;
+    hash = mix(hash, x);
+    hash = mix(hash, y);
+    hash = mix(hash, surface->current.width);
+    hash = mix(hash, surface->current.height);
+    hash = subsurface_shape(hash, &surface->subsurfaces_below);
+    hash = subsurface_shape(hash, &surface->subsurfaces_above);
+    if (hash != *shape || surface->current.committed & WLR_SURFACE_STATE_INPUT_REGION) {
+	*shape = hash;
+	scene_changed();
+    }
+}
+
+
+void scene_update_view(struct view *view) {
+    /* A view was moved, resized, mapped or moved to another desk. */
+    scene_changed();
+    grid_update_view(view);
+    bool shown = view->surface->mapped && (view->is_scratchpad || view->desk == wimp.current_desk);
+    update_view_outputs(view, shown);
+}
+
+
+void scene_remove_view(struct view *view) {
+    /* A view was unmapped or destroyed. */
+    scene_changed();
+    if (view->desk) {
+	grid_remove_view(view);
+    }
+    update_view_outputs(view, false);
+}
+
+
+void scene_update_camera(struct desk *desk) {
+    /* A desk's camera was panned or zoomed. Which outputs its views are on is
+     * worked out when the next frame is drawn, so that any number of camera
+     * changes in one frame are dealt with once. */
+    scene_changed();
+    desk->outputs_dirty = true;
+    damage_all_outputs();
+    fractional_scale_schedule();
+}
+
+
+void scene_set_desk(struct desk *desk) {
+    struct view *view;
+    wl_list_for_each(view, &wimp.current_desk->views, link) {
+	update_view_outputs(view, false);
+    }
+    wimp.current_desk = desk;
+    scene_update_camera(desk);
+}
+
+
+void scene_remove_output(struct wlr_output *wlr_output) {
+    /* Views don't keep pointing at an output that is going away. They pick a
+     * new primary output the next time any output sends frame callbacks. */
+    struct desk *desk;
+    struct view *view;
+    wl_list_for_each(desk, &wimp.desks, link) {
+	wl_list_for_each(view, &desk->views, link) {
+	    if (view->primary_output == wlr_output) {
+		view->primary_output = NULL;
+	    }
+	}
+	desk->outputs_dirty = true;
+    }
+
+    struct scratchpad *scratchpad;
+    wl_list_for_each(scratchpad, &wimp.scratchpads, link) {
+	view = scratchpad->view;
+	if (view && view->primary_output == wlr_output) {
+	    view->primary_output = NULL;
+	}
+    }
+}
+
+
+static void update_shown_views(struct desk *desk) {
+    /* Only views in the part of the canvas that was shown before the camera or
+     * the outputs changed, or that is shown now, can have changed outputs. */
+    struct wlr_box *extents = wlr_output_layout_get_box(wimp.output_layout, NULL);
+    struct wlr_box shown;
+    canvas_area(desk, extents->x, extents->y, extents->width, extents->height, &shown);
+
+    struct wl_array views;
+    wl_array_init(&views);
+    grid_query(desk, &desk->shown_area, &views);
+    grid_query(desk, &shown, &views);
+    desk->shown_area = shown;
+
+    // views in both areas are next to each other once sorted by stack
+    struct view **found = views.data;
+    int nfound = views.size / sizeof(struct view *);
+    for (int i = 0; i < nfound; i++) {
+	if (i == 0 || found[i] != found[i - 1]) {
+	    update_view_outputs(found[i], found[i]->surface->mapped);
+	}
+    }
+    wl_array_release(&views);
+}
+
+
+static void frame_done_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    wlr_surface_send_frame_done(surface, data);
+}
+
+
+void scene_send_frame_done(struct output *output, struct timespec *when) {
+    /* Let every client shown on the output know that now is a good time to draw,
+     * whether or not their surfaces were redrawn in this frame. */
+    struct desk *desk = wimp.current_desk;
+    if (desk->outputs_dirty) {
+	desk->outputs_dirty = false;
+	update_shown_views(desk);
+	struct scratchpad *scratchpad;
+	wl_list_for_each(scratchpad, &wimp.scratchpads, link) {
+	    if (scratchpad->view) {
+		update_view_outputs(scratchpad->view, scratchpad->is_mapped);
+	    }
+	}
+    }
+
+    struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, output->wlr_output);
+    if (!ogeo) {
+	return;
+    }
+    struct wl_array nodes;
+    wl_array_init(&nodes);
+    scene_collect(output, ogeo, &nodes);
+    struct scene_node *node;
+    wl_array_for_each(node, &nodes) {
+	// views shown on several outputs only get callbacks from one of them
+	if (!node->view || node->view->primary_output == output->wlr_output) {
+	    scene_node_for_each_surface(node, frame_done_iterator, when);
+	}
+    }
+    wl_array_release(&nodes);
+}
+
+
+static void hidden_frame_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    // anything committed while hidden was never shown
+    struct wlr_presentation_feedback *feedback =
+	wlr_presentation_surface_sampled(wimp.presentation, surface);
+    if (feedback) {
+	wlr_presentation_feedback_destroy(feedback);
+    }
+    wlr_surface_send_frame_done(surface, data);
+}
+
+
+static int on_hidden_frame(void *data) {
+    /* Views that aren't shown on any output never get frame callbacks from
+     * drawing, so their clients are sent them slowly instead. This keeps them
+     * from stalling without letting them draw frames that nobody sees. As soon
+     * as they are shown again, they get callbacks with every frame. */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct desk *desk;
+    struct view *view;
+    wl_list_for_each(desk, &wimp.desks, link) {
+	wl_list_for_each(view, &desk->views, link) {
+	    if (view->surface->mapped && !view->primary_output) {
+		wlr_xdg_surface_for_each_surface(view->surface, hidden_frame_iterator, &now);
+	    }
+	}
+    }
+
+    struct scratchpad *scratchpad;
+    wl_list_for_each(scratchpad, &wimp.scratchpads, link) {
+	view = scratchpad->view;
+	if (scratchpad->is_mapped && !view->primary_output) {
+	    wlr_xdg_surface_for_each_surface(view->surface, hidden_frame_iterator, &now);
+	}
+    }
+
+    wl_event_source_timer_update(wimp.hidden_frame_timer, HIDDEN_FRAME_INTERVAL);
+    return 0;
+}
+
+
+void set_up_scene() {
+    struct wl_event_loop *event_loop = wl_display_get_event_loop(wimp.display);
+    wimp.hidden_frame_timer = wl_event_loop_add_timer(event_loop, on_hidden_frame, NULL);
+    wl_event_source_timer_update(wimp.hidden_frame_timer, HIDDEN_FRAME_INTERVAL);
+
+    last_hit.surface_destroy_listener.notify = on_hit_surface_destroy;
+    wl_list_init(&last_hit.surface_destroy_listener.link);
+}
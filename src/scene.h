@@ -0,0 +1,24 @@
+#ifndef WIMP_SCENE_H
+#define WIMP_SCENE_H
+
+#include "types.h"
+
+void scene_collect(struct output *output, struct wlr_box *area, struct wl_array *nodes);
+void scene_node_for_each_surface(
+    struct scene_node *node, wlr_surface_iterator_func_t iterator, void *data
+);
+bool scene_node_at(
+    double lx, double ly, struct scene_node *found,
+    struct wlr_surface **surface, double *sx, double *sy
+);
+void scene_changed();
+void scene_surface_committed(struct wlr_surface *surface, int x, int y, uint32_t *shape);
+void scene_update_view(struct view *view);
+void scene_remove_view(struct view *view);
+void scene_update_camera(struct desk *desk);
+void scene_set_desk(struct desk *desk);
+void scene_remove_output(struct wlr_output *wlr_output);
+void scene_send_frame_done(struct output *output, struct timespec *when);
+void set_up_scene();
+
+#endif
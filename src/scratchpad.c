@@ -1,3 +1,4 @@
+#include "desk.h"
 #include "shell.h"
 #include "scratchpad.h"
 #include "types.h"
@@ -84,6 +85,9 @@ void drop_scratchpads() {
     wl_list_for_each_safe(scratchpad, tmp, &wimp.scratchpads, link) {
 	if (scratchpad->view) {
 	    scratchpad->view->is_scratchpad = false;
+	    scratchpad->view->desk = wimp.current_desk;
+	    scratchpad->view->stack = ++wimp.current_desk->stack_top;
+	    view_set_position(scratchpad->view, scratchpad->view->x, scratchpad->view->y);
 	    wl_list_insert(&wimp.current_desk->views, &scratchpad->view->link);
 	    map_view(scratchpad->view);
 	}
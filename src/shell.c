@@ -1,31 +1,99 @@
+#include <math.h>
 #include <wlr/types/wlr_layer_shell_v1.h>
 #include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/edges.h>
 
 #include "action.h"
+#include "desk.h"
+#include "grid.h"
 #include "output.h"
+#include "scene.h"
 #include "scratchpad.h"
+#include "snapshot.h"
+#include "tearing_control.h"
+#include "transaction.h"
 #include "types.h"
 
 
+static void cancel_resize(struct view *view) {
+    view->resize_in_flight = false;
+    view->resize_queued = false;
+    wl_event_source_timer_update(view->resize_timer, 0);
+}
+
+
 void view_apply_geometry(struct view *view, struct wlr_box *new) {
+    /* Only one resize is sent to a client at a time. Any asked for while it is
+     * in flight are merged into the latest, which is sent once the client has
+     * acked and drawn the first, or after RESIZE_TIMEOUT if it doesn't. Until
+     * then the view keeps its old buffer and position, so that edges being
+     * dragged don't jitter. Resizes made as part of a transaction are sent
+     * straight away so that they are shown with the rest of it. */
     if (new->width <= 0 || new->height <= 0) {
 	return;
     }
+    if (view->resize_in_flight) {
+	if (wimp.transaction_depth == 0) {
+	    view->resize_next = *new;
+	    view->resize_queued = true;
+	    return;
+	}
+	view->resize_queued = false;
+    }
 
-    struct wlr_box old = {
-	.x = view->x,
-	.y = view->y,
-	.width = view->surface->geometry.width,
-	.height = view->surface->geometry.height,
+    uint32_t serial = wlr_xdg_toplevel_set_size(view->surface, new->width, new->height);
+    if (serial == 0) {
+	// the size didn't change, so it can be moved right away
+	damage_by_view(view, true);
+	view_set_position(view, new->x, new->y);
+	scene_update_view(view);
+	damage_by_view(view, true);
+	return;
+    }
+
+    double zoom = view->is_scratchpad ? 1 : wimp.current_desk->zoom;
+    struct wlr_box layout_box = {
+	.x = new->x * zoom,
+	.y = new->y * zoom,
+	.width = new->width * zoom,
+	.height = new->height * zoom,
     };
+    transaction_add_view(view, serial, &layout_box);
+
+    view->resize_serial = serial;
+    view->resize_in_flight = true;
+    view->resize_x = new->x;
+    view->resize_y = new->y;
+    if (!view->is_scratchpad) {
+	view->resize_x -= view->desk->panned_x;
+	view->resize_y -= view->desk->panned_y;
+    }
+    wl_event_source_timer_update(view->resize_timer, RESIZE_TIMEOUT);
+}
 
-    view->x = new->x;
-    view->y = new->y,
-    wlr_xdg_toplevel_set_size(view->surface, new->width, new->height);
-    damage_box(&old, true);
-    damage_box(new, true);
+
+static int on_resize_timeout(void *data) {
+    /* The client hasn't drawn the last resize in time, so the view is placed
+     * as though it had and any resize queued behind it is sent. */
+    struct view *view = data;
+    if (!view->resize_in_flight) {
+	return 0;
+    }
+    wlr_log(WLR_DEBUG, "Resize timed out waiting for client");
+
+    damage_by_view(view, true);
+    view->resize_in_flight = false;
+    view->x = view->resize_x;
+    view->y = view->resize_y;
+    scene_update_view(view);
+    damage_by_view(view, true);
+
+    if (view->resize_queued) {
+	view->resize_queued = false;
+	view_apply_geometry(view, &view->resize_next);
+    }
+    return 0;
 }
 
 
@@ -70,7 +138,9 @@ void focus(void *data, struct wlr_surface *surface, bool is_layer) {
     if (prev_surface && wlr_surface_is_xdg_surface(prev_surface)) {
 	struct wlr_xdg_surface *prev_xdg_surface = wlr_xdg_surface_from_wlr_surface(prev_surface);
 	wlr_xdg_toplevel_set_activated(prev_xdg_surface, false);
-	damage_by_view(prev_xdg_surface->data, true);
+	if (prev_xdg_surface->data) {
+	    damage_view_borders(prev_xdg_surface->data);
+	}
     }
 
     if (!data) {
@@ -96,12 +166,20 @@ void focus(void *data, struct wlr_surface *surface, bool is_layer) {
 	damage_by_lview(lview);
 
     } else {
+	// Only the borders change colour unless the view also needs raising.
+	bool raised = true;
 	if (view->is_scratchpad) {
 	    struct scratchpad *scratchpad = scratchpad_from_view(view);
 	    scratchpad->is_mapped = true;
+	    scene_changed();
 	} else {
+	    raised = wimp.current_desk->views.next != &view->link;
 	    wl_list_remove(&view->link);
 	    wl_list_insert(&wimp.current_desk->views, &view->link);
+	    if (raised) {
+		view->stack = ++view->desk->stack_top;
+		scene_changed();
+	    }
 	}
 	if (!surface) {
 	    surface = view->surface->surface;
@@ -113,7 +191,11 @@ void focus(void *data, struct wlr_surface *surface, bool is_layer) {
 	    wimp.seat, surface, keyboard->keycodes,
 	    keyboard->num_keycodes, &keyboard->modifiers
 	);
-	damage_by_view(view, true);
+	if (raised) {
+	    damage_by_view(view, true);
+	} else {
+	    damage_view_borders(view);
+	}
     }
 }
 
@@ -144,8 +226,8 @@ void find_focus() {
 
 void pan_to_view(struct view *view) {
     int border_width = wimp.current_desk->border_width;
-    double x = view->x - border_width;
-    double y = view->y - border_width;
+    double x = view_x(view) - border_width;
+    double y = view_y(view) - border_width;
     double width = view->surface->geometry.width + border_width * 2;
     double height = view->surface->geometry.height + border_width * 2;
     struct wlr_box *extents = wlr_output_layout_get_box(wimp.output_layout, NULL);
@@ -184,43 +266,70 @@ void fullscreen_xdg_surface(
     /* wlr_output can be NULL, in which case it is calculated using the surface's position */
     struct wlr_box *saved_geo = &wimp.current_desk->fullscreened_saved_geo;
 
+    // any interactive resize under way is superseded
+    cancel_resize(view);
+
+    // the view leaving fullscreen and the one entering it are shown together
+    transaction_begin();
+    double zoom = wimp.current_desk->zoom;
     struct wlr_xdg_surface *prev_surface = wimp.current_desk->fullscreened;
     if (prev_surface) {
+	struct view *prev = prev_surface->data;
+	cancel_resize(prev);
 	wlr_xdg_toplevel_set_fullscreen(prev_surface, false);
-	wlr_xdg_toplevel_set_tiled(view->surface, true);
-	wlr_xdg_toplevel_set_size(prev_surface, saved_geo->width, saved_geo->height);
-	view->x = saved_geo->x;
-	view->y = saved_geo->y;
+	wlr_xdg_toplevel_set_tiled(prev_surface, true);
+	uint32_t serial = wlr_xdg_toplevel_set_size(
+	    prev_surface, saved_geo->width, saved_geo->height
+	);
+	struct wlr_box restored = {
+	    .x = (saved_geo->x + wimp.current_desk->panned_x) * zoom,
+	    .y = (saved_geo->y + wimp.current_desk->panned_y) * zoom,
+	    .width = saved_geo->width * zoom,
+	    .height = saved_geo->height * zoom,
+	};
+	transaction_add_view(prev, serial, &restored);
+	prev->x = saved_geo->x;
+	prev->y = saved_geo->y;
+	scene_update_view(prev);
+	damage_by_view(prev, true);
     }
 
     if (prev_surface == xdg_surface) {
 	wimp.current_desk->fullscreened = NULL;
+	transaction_commit();
 	return;
     }
 
-    if (xdg_surface->role != WLR_XDG_SURFACE_ROLE_TOPLEVEL)
+    if (xdg_surface->role != WLR_XDG_SURFACE_ROLE_TOPLEVEL) {
+	transaction_commit();
 	return;
+    }
 
     if (!wlr_output) {
-	double x = view->x + xdg_surface->geometry.width / 2;
-	double y = view->y + xdg_surface->geometry.height / 2;
+	double x = view_x(view) + xdg_surface->geometry.width / 2;
+	double y = view_y(view) + xdg_surface->geometry.height / 2;
 	double lx, ly;
 	wlr_output_layout_closest_point(wimp.output_layout, NULL, x, y, &lx, &ly);
 	wlr_output = wlr_output_layout_output_at(wimp.output_layout, lx, ly);
     }
 
+    // The view is placed and sized to cover the output exactly, so that its
+    // buffer can be scanned out directly.
+    struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, wlr_output);
     wimp.current_desk->fullscreened = xdg_surface;
     saved_geo->x = view->x;
     saved_geo->y = view->y;
-    view->x = view->y = 0;
+    view_set_position(view, ogeo->x / zoom, ogeo->y / zoom);
+    scene_update_view(view);
     saved_geo->width = xdg_surface->geometry.width;
     saved_geo->height = xdg_surface->geometry.height;
     wlr_xdg_toplevel_set_fullscreen(xdg_surface, true);
     wlr_xdg_toplevel_set_tiled(view->surface, false);
-    double zoom = wimp.current_desk->zoom;
-    wlr_xdg_toplevel_set_size(xdg_surface, wlr_output->width / zoom, wlr_output->height / zoom);
+    uint32_t serial = wlr_xdg_toplevel_set_size(xdg_surface, ogeo->width / zoom, ogeo->height / zoom);
+    transaction_add_view(view, serial, ogeo);
     struct output *output = wlr_output->data;
     wlr_output_damage_add_whole(output->wlr_output_damage);
+    transaction_commit();
 }
 
 
@@ -233,7 +342,55 @@ void unfullscreen() {
 
 static void on_commit(struct wl_listener *listener, void *data) {
     struct view *view = wl_container_of(listener, view, commit_listener);
-    damage_by_view(view, false);
+    struct wlr_surface *surface = view->surface->surface;
+
+    // its input region or subsurfaces may have changed
+    scene_surface_committed(surface, 0, 0, &view->shape);
+    snapshot_damage(&view->snapshot);
+
+    transaction_view_committed(view);
+
+    // a resize that has been acked is drawn at its new size from this commit
+    bool resized = view->resize_in_flight &&
+	(int32_t)(view->surface->configure_serial - view->resize_serial) >= 0;
+    if (
+	!resized &&
+	surface->current.width == view->width && surface->current.height == view->height
+    ) {
+	damage_view_surfaces(view);
+	if (
+	    view->desk && view->desk->fullscreened == view->surface && view->primary_output &&
+	    tearing_allowed(view)
+	) {
+	    present_now(view->primary_output->data);
+	}
+	return;
+    }
+
+    // The view changed size so its old area and borders need repainting too.
+    double zoom = view->is_scratchpad ? 1 : wimp.current_desk->zoom;
+    struct wlr_box old = {
+	.x = view_x(view) * zoom,
+	.y = view_y(view) * zoom,
+	.width = ceil(view->width * zoom),
+	.height = ceil(view->height * zoom),
+    };
+    damage_box(&old, true);
+    view->width = surface->current.width;
+    view->height = surface->current.height;
+    if (resized) {
+	view->resize_in_flight = false;
+	wl_event_source_timer_update(view->resize_timer, 0);
+	view->x = view->resize_x;
+	view->y = view->resize_y;
+    }
+    scene_update_view(view);
+    damage_by_view(view, true);
+
+    if (view->resize_queued) {
+	view->resize_queued = false;
+	view_apply_geometry(view, &view->resize_next);
+    }
 }
 
 
@@ -249,6 +406,7 @@ static void on_map(struct wl_listener *listener, void *data) {
 	scratchpad->is_mapped = true;
     }
 
+    scene_update_view(view);
     wlr_xdg_toplevel_set_tiled(view->surface, true);
     focus_view(view, NULL);
 }
@@ -263,7 +421,11 @@ static void on_unmap(struct wl_listener *listener, void *data) {
     } else {
 	wl_list_remove(&view->link);
 	wl_list_insert(wimp.current_desk->views.prev, &view->link);
+	view->stack = --view->desk->stack_bottom;
     }
+    scene_remove_view(view);
+    transaction_remove_view(view);
+    cancel_resize(view);
 
     wl_list_remove(&view->commit_listener.link);
     damage_by_view(view, true);
@@ -286,8 +448,13 @@ static void on_surface_destroy(struct wl_listener *listener, void *data) {
 	scratchpad->view = NULL;
     } else {
 	wl_list_remove(&view->link);
+	grid_remove_view(view);
     }
 
+    transaction_remove_view(view);
+    tearing_control_detach(view);
+    wl_event_source_remove(view->resize_timer);
+    snapshot_finish(&view->snapshot);
     free(view);
 }
 
@@ -302,13 +469,13 @@ static void process_move_resize(struct view *view, enum cursor_mode mode, uint32
     wimp.cursor_mode = mode;
 
     double zoom = wimp.current_desk->zoom;
-    wimp.grab_x = wimp.cursor->x - view->x * zoom;
-    wimp.grab_y = wimp.cursor->y - view->y * zoom;
+    wimp.grab_x = wimp.cursor->x - view_x(view) * zoom;
+    wimp.grab_y = wimp.cursor->y - view_y(view) * zoom;
 
     if (mode == CURSOR_RESIZE) {
 	wlr_xdg_surface_get_geometry(view->surface, &wimp.grab_geobox);
-	wimp.grab_geobox.x = view->x;
-	wimp.grab_geobox.y = view->y;
+	wimp.grab_geobox.x = view_x(view);
+	wimp.grab_geobox.y = view_y(view);
 	wimp.resize_edges = edges;
     }
 }
@@ -336,8 +503,51 @@ static void on_request_fullscreen(struct wl_listener *listener, void *data) {
 }
 
 
+static void on_popup_change(struct wl_listener *listener, void *data) {
+    /* Popups appear and go without their toplevel committing, so they
+     * invalidate the cached hit test themselves. */
+    scene_changed();
+}
+
+
+static void on_popup_commit(struct wl_listener *listener, void *data) {
+    struct popup *popup = wl_container_of(listener, popup, commit_listener);
+    struct wlr_box *geo = &popup->surface->popup->geometry;
+    scene_surface_committed(popup->surface->surface, geo->x, geo->y, &popup->shape);
+}
+
+
+static void on_popup_destroy(struct wl_listener *listener, void *data) {
+    struct popup *popup = wl_container_of(listener, popup, destroy_listener);
+    wl_list_remove(&popup->map_listener.link);
+    wl_list_remove(&popup->unmap_listener.link);
+    wl_list_remove(&popup->commit_listener.link);
+    wl_list_remove(&popup->destroy_listener.link);
+    free(popup);
+    scene_changed();
+}
+
+
+static void track_popup(struct wlr_xdg_surface *surface) {
+    struct popup *popup = calloc(1, sizeof(struct popup));
+    popup->surface = surface;
+    popup->map_listener.notify = on_popup_change;
+    wl_signal_add(&surface->events.map, &popup->map_listener);
+    popup->unmap_listener.notify = on_popup_change;
+    wl_signal_add(&surface->events.unmap, &popup->unmap_listener);
+    popup->commit_listener.notify = on_popup_commit;
+    wl_signal_add(&surface->surface->events.commit, &popup->commit_listener);
+    popup->destroy_listener.notify = on_popup_destroy;
+    wl_signal_add(&surface->events.destroy, &popup->destroy_listener);
+}
+
+
 static void on_new_xdg_surface(struct wl_listener *listener, void *data) {
     struct wlr_xdg_surface *surface = data;
+    if (surface->role == WLR_XDG_SURFACE_ROLE_POPUP) {
+	track_popup(surface);
+	return;
+    }
     if (surface->role != WLR_XDG_SURFACE_ROLE_TOPLEVEL) {
 	return;
     }
@@ -345,6 +555,10 @@ static void on_new_xdg_surface(struct wl_listener *listener, void *data) {
     struct view *view = calloc(1, sizeof(struct view));
     view->surface = surface;
     surface->data = view;
+    wl_list_init(&view->grid_entries);
+    tearing_control_attach(view);
+    struct wl_event_loop *event_loop = wl_display_get_event_loop(wimp.display);
+    view->resize_timer = wl_event_loop_add_timer(event_loop, on_resize_timeout, view);
 
     view->map_listener.notify = on_map;
     wl_signal_add(&surface->events.map, &view->map_listener);
@@ -368,8 +582,9 @@ static void on_new_xdg_surface(struct wl_listener *listener, void *data) {
     }
 
     view->is_scratchpad = false;
-    view->x = wimp.current_desk->border_width;
-    view->y = wimp.current_desk->border_width;
+    view->desk = wimp.current_desk;
+    view->stack = ++view->desk->stack_top;
+    view_set_position(view, view->desk->border_width, view->desk->border_width);
     wl_list_insert(&wimp.current_desk->views, &view->link);
 }
 
@@ -0,0 +1,402 @@
+#include <GLES2/gl2.h>
+#include <math.h>
+#include <string.h>
+#include <wlr/render/gles2.h>
+#include <wlr/types/wlr_output_layout.h>
+
+#include "gl.h"
+#include "snapshot.h"
+#include "types.h"
+
+
+/* When zoomed far out, views are drawn from snapshots of their surfaces that
+ * have been shrunk to about the size that they are shown at. Each snapshot is
+ * made with a filter that averages every pixel it covers, once per commit by
+ * the client, rather than sampling the full-sized texture on every frame,
+ * which is slow and aliases badly. Snapshots are kept at power-of-two scales so
+ * that zooming doesn't remake them on every step. Views with subsurfaces or
+ * popups are always drawn live, as their commits aren't tracked here. */
+
+
+static const GLchar vertex_src[] =
+    "uniform mat3 proj;\n"
+    "attribute vec2 pos;\n"
+    "attribute vec2 texcoord;\n"
+    "varying vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
+    "    v_texcoord = texcoord;\n"
+    "}\n";
+
+// 4x4 bilinear samples spread over each pixel's footprint covers shrinking by
+// up to 8 times.
+static const GLchar downsample_src[] =
+    "precision mediump float;\n"
+    "varying vec2 v_texcoord;\n"
+    "uniform sampler2D tex;\n"
+    "uniform vec2 footprint;\n"
+    "uniform float opaque;\n"
+    "void main() {\n"
+    "    vec4 sum = vec4(0.0);\n"
+    "    for (int i = 0; i < 4; i++) {\n"
+    "        for (int j = 0; j < 4; j++) {\n"
+    "            vec2 offset = (vec2(float(i), float(j)) + 0.5) / 4.0 - 0.5;\n"
+    "            sum += texture2D(tex, v_texcoord + offset * footprint);\n"
+    "        }\n"
+    "    }\n"
+    "    sum /= 16.0;\n"
+    "    gl_FragColor = opaque > 0.5 ? vec4(sum.rgb, 1.0) : sum;\n"
+    "}\n";
+
+static const GLchar draw_src[] =
+    "precision mediump float;\n"
+    "varying vec2 v_texcoord;\n"
+    "uniform sampler2D tex;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(tex, v_texcoord);\n"
+    "}\n";
+
+struct program {
+    GLuint program;
+    GLint proj;
+    GLint pos;
+    GLint texcoord;
+    GLint tex;
+    GLint footprint;
+    GLint opaque;
+};
+
+static struct {
+    bool tried;
+    struct program downsample;
+    struct program draw;
+} shaders = { 0 };
+
+// GL objects of freed snapshots, deleted once the renderer's context is current
+static struct wl_array retired = { 0 };
+
+
+static bool build_program(struct program *program, const GLchar *fragment_src) {
+    program->program = gl_link_program(vertex_src, fragment_src);
+    if (!program->program) {
+	return false;
+    }
+    program->proj = glGetUniformLocation(program->program, "proj");
+    program->pos = glGetAttribLocation(program->program, "pos");
+    program->texcoord = glGetAttribLocation(program->program, "texcoord");
+    program->tex = glGetUniformLocation(program->program, "tex");
+    program->footprint = glGetUniformLocation(program->program, "footprint");
+    program->opaque = glGetUniformLocation(program->program, "opaque");
+    return true;
+}
+
+
+static bool set_up_shaders() {
+    /* The shaders are built on first use, when the renderer's context is current. */
+    if (shaders.tried) {
+	return shaders.draw.program != 0;
+    }
+    shaders.tried = true;
+
+    if (!wlr_renderer_is_gles2(wimp.renderer)) {
+	return false;
+    }
+
+    if (!build_program(&shaders.downsample, downsample_src) || !build_program(&shaders.draw, draw_src)) {
+	wlr_log(WLR_ERROR, "Failed to build snapshot shaders; zoomed out views won't be cached.");
+	shaders.draw.program = 0;
+	return false;
+    }
+    return true;
+}
+
+
+void snapshot_damage(struct snapshot *snapshot) {
+    snapshot->dirty = true;
+}
+
+
+void snapshot_finish(struct snapshot *snapshot) {
+    /* Free a snapshot. This can be called at any time; its GL objects are freed
+     * by snapshot_free_retired. */
+    if (snapshot->texture) {
+	GLuint *names = wl_array_add(&retired, 2 * sizeof(GLuint));
+	names[0] = snapshot->texture;
+	names[1] = snapshot->framebuffer;
+    }
+    snapshot->texture = 0;
+    snapshot->framebuffer = 0;
+    snapshot->dirty = true;
+}
+
+
+void snapshot_free_retired() {
+    /* Must be called while the renderer's context is current. */
+    GLuint *names = retired.data;
+    for (size_t i = 0; i < retired.size / sizeof(GLuint); i += 2) {
+	glDeleteFramebuffers(1, &names[i + 1]);
+	glDeleteTextures(1, &names[i]);
+    }
+    retired.size = 0;
+}
+
+
+static void draw_quads(struct program *program, float *proj, struct wl_array *vertices) {
+    /* Draw triangles whose vertices are laid out as x, y, u, v. */
+    GLsizei stride = 4 * sizeof(GLfloat);
+    GLfloat *data = vertices->data;
+    glUniformMatrix3fv(program->proj, 1, GL_FALSE, proj);
+    glUniform1i(program->tex, 0);
+    glVertexAttribPointer(program->pos, 2, GL_FLOAT, GL_FALSE, stride, data);
+    glVertexAttribPointer(program->texcoord, 2, GL_FLOAT, GL_FALSE, stride, data + 2);
+    glEnableVertexAttribArray(program->pos);
+    glEnableVertexAttribArray(program->texcoord);
+    glDrawArrays(GL_TRIANGLES, 0, vertices->size / stride);
+    glDisableVertexAttribArray(program->pos);
+    glDisableVertexAttribArray(program->texcoord);
+}
+
+
+static void add_quad(
+    struct wl_array *vertices, float x1, float y1, float x2, float y2,
+    float u1, float v1, float u2, float v2
+) {
+    GLfloat quad[6][4] = {
+	{ x1, y1, u1, v1 }, { x2, y1, u2, v1 }, { x1, y2, u1, v2 },
+	{ x2, y1, u2, v1 }, { x2, y2, u2, v2 }, { x1, y2, u1, v2 },
+    };
+    GLfloat *vertex = wl_array_add(vertices, sizeof(quad));
+    memcpy(vertex, quad, sizeof(quad));
+}
+
+
+static bool create_target(struct snapshot *snapshot, int width, int height) {
+    snapshot_finish(snapshot);
+    glGenTextures(1, &snapshot->texture);
+    glBindTexture(GL_TEXTURE_2D, snapshot->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenFramebuffers(1, &snapshot->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, snapshot->framebuffer);
+    glFramebufferTexture2D(
+	GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, snapshot->texture, 0
+    );
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+	snapshot_finish(snapshot);
+	return false;
+    }
+    snapshot->width = width;
+    snapshot->height = height;
+    return true;
+}
+
+
+static bool update_snapshot(struct snapshot *snapshot, struct wlr_surface *surface, double scale) {
+    /* Redraw a snapshot of a surface at the given scale. If the surface has no
+     * buffer, any existing snapshot is kept as it is. */
+    struct wlr_texture *texture = wlr_surface_get_texture(surface);
+    if (texture == NULL) {
+	return snapshot->texture != 0;
+    }
+
+    struct wlr_gles2_texture_attribs attribs;
+    if (!wlr_texture_is_gles2(texture)) {
+	snapshot_finish(snapshot);
+	return false;
+    }
+    wlr_gles2_texture_get_attribs(texture, &attribs);
+    int width = ceil(surface->current.width * scale);
+    int height = ceil(surface->current.height * scale);
+    if (
+	attribs.target != GL_TEXTURE_2D || width <= 0 || height <= 0 ||
+	surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL
+    ) {
+	snapshot_finish(snapshot);
+	return false;
+    }
+
+    GLint framebuffer, viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    wlr_renderer_scissor(wimp.renderer, NULL);
+
+    bool ok = true;
+    if (!snapshot->texture || snapshot->width != width || snapshot->height != height) {
+	ok = create_target(snapshot, width, height);
+    }
+
+    if (ok) {
+	glBindFramebuffer(GL_FRAMEBUFFER, snapshot->framebuffer);
+	glViewport(0, 0, width, height);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, attribs.tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// Map the snapshot's pixels straight to GL coordinates. The snapshot is
+	// stored top row first, like the textures of clients' buffers.
+	GLfloat proj[9] = {
+	    2.0 / width, 0, 0,
+	    0, 2.0 / height, 0,
+	    -1, -1, 1,
+	};
+	// only the part of the buffer that the client cropped it to is shown
+	struct wlr_fbox src;
+	wlr_surface_get_buffer_source_box(surface, &src);
+	float u1 = src.x / surface->current.buffer_width;
+	float u2 = (src.x + src.width) / surface->current.buffer_width;
+	float v1 = src.y / surface->current.buffer_height;
+	float v2 = (src.y + src.height) / surface->current.buffer_height;
+	if (attribs.inverted_y) {
+	    v1 = 1 - v1;
+	    v2 = 1 - v2;
+	}
+	struct wl_array vertices;
+	wl_array_init(&vertices);
+	add_quad(&vertices, 0, 0, width, height, u1, v1, u2, v2);
+
+	struct program *program = &shaders.downsample;
+	glDisable(GL_BLEND);
+	glUseProgram(program->program);
+	glUniform2f(program->footprint, (u2 - u1) / width, fabs(v2 - v1) / height);
+	glUniform1f(program->opaque, attribs.has_alpha ? 0 : 1);
+	draw_quads(program, proj, &vertices);
+	glEnable(GL_BLEND);
+	wl_array_release(&vertices);
+
+	snapshot->scale = scale;
+	snapshot->dirty = false;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    return ok;
+}
+
+
+static void count_surface_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    size_t *n = data;
+    (*n)++;
+}
+
+
+static double max_output_scale(
+    struct wlr_surface *surface, struct wlr_output *output, int x, int y, double zoom
+) {
+    /* Find the largest scale of the outputs that a surface drawn on output at
+     * x, y is shown on, so that a view straddling outputs of different scales
+     * shares one snapshot between them rather than remaking it for each. */
+    double max_scale = output->scale;
+    struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, output);
+    if (!ogeo) {
+	return max_scale;
+    }
+    struct wlr_box box = {
+	.x = ogeo->x + x * zoom,
+	.y = ogeo->y + y * zoom,
+	.width = ceil(surface->current.width * zoom),
+	.height = ceil(surface->current.height * zoom),
+    };
+    struct wlr_box intersection;
+    struct output *other;
+    wl_list_for_each(other, &wimp.outputs, link) {
+	struct wlr_box *box2 = wlr_output_layout_get_box(wimp.output_layout, other->wlr_output);
+	if (
+	    other->wlr_output->scale > max_scale && box2 &&
+	    wlr_box_intersection(&intersection, &box, box2)
+	) {
+	    max_scale = other->wlr_output->scale;
+	}
+    }
+    return max_scale;
+}
+
+
+static bool render_snapshot(
+    struct view *view, struct wlr_output *output, int x, int y, double zoom,
+    pixman_region32_t *damage
+) {
+    struct snapshot *snapshot = &view->snapshot;
+    struct wlr_surface *surface = view->surface->surface;
+    double scale = output->scale * zoom;
+    double level = pow(2, ceil(log2(max_output_scale(surface, output, x, y, zoom) * zoom)));
+    if (snapshot->dirty || !snapshot->texture || snapshot->scale != level) {
+	if (!update_snapshot(snapshot, surface, level)) {
+	    return false;
+	}
+    }
+
+    // draw the parts of the snapshot that are in the damage
+    float bx = x * scale;
+    float by = y * scale;
+    float bw = snapshot->width * scale / snapshot->scale;
+    float bh = snapshot->height * scale / snapshot->scale;
+    pixman_region32_t region;
+    pixman_region32_init_rect(&region, bx, by, ceil(bw), ceil(bh));
+    pixman_region32_intersect(&region, &region, damage);
+
+    struct wl_array vertices;
+    wl_array_init(&vertices);
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+    for (int i = 0; i < nrects; i++) {
+	pixman_box32_t *r = &rects[i];
+	add_quad(
+	    &vertices, r->x1, r->y1, r->x2, r->y2,
+	    (r->x1 - bx) / bw, (r->y1 - by) / bh, (r->x2 - bx) / bw, (r->y2 - by) / bh
+	);
+    }
+
+    if (vertices.size) {
+	float proj[9];
+	gl_output_projection(output, proj);
+	wlr_renderer_scissor(wimp.renderer, NULL);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, snapshot->texture);
+	glUseProgram(shaders.draw.program);
+	draw_quads(&shaders.draw, proj, &vertices);
+	glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    wl_array_release(&vertices);
+    pixman_region32_fini(&region);
+    return true;
+}
+
+
+bool snapshot_render(
+    struct view *view, struct wlr_output *output, int x, int y, double zoom,
+    pixman_region32_t *damage
+) {
+    /* Draw a view from its snapshot if it is zoomed out far enough to have one,
+     * where x and y are its output-local position before zooming, as used when
+     * rendering it. If false is returned the view should be drawn live. */
+    if (zoom >= SNAPSHOT_ZOOM || !set_up_shaders()) {
+	return false;
+    }
+
+    size_t n_surfaces = 0;
+    wlr_xdg_surface_for_each_surface(view->surface, count_surface_iterator, &n_surfaces);
+    if (n_surfaces != 1) {
+	snapshot_finish(&view->snapshot);
+	return false;
+    }
+    return render_snapshot(view, output, x, y, zoom, damage);
+}
+
+
+bool snapshot_render_thumbnail(
+    struct view *view, struct wlr_output *output, int x, int y, double zoom,
+    pixman_region32_t *damage
+) {
+    /* Like snapshot_render, but for views shown so small that only their main
+     * surface is worth drawing, whatever the zoom and whatever else they have. */
+    if (!set_up_shaders()) {
+	return false;
+    }
+    return render_snapshot(view, output, x, y, zoom, damage);
+}
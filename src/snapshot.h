@@ -0,0 +1,18 @@
+#ifndef WIMP_SNAPSHOT_H
+#define WIMP_SNAPSHOT_H
+
+#include "types.h"
+
+void snapshot_damage(struct snapshot *snapshot);
+void snapshot_finish(struct snapshot *snapshot);
+void snapshot_free_retired();
+bool snapshot_render(
+    struct view *view, struct wlr_output *output, int x, int y, double zoom,
+    pixman_region32_t *damage
+);
+bool snapshot_render_thumbnail(
+    struct view *view, struct wlr_output *output, int x, int y, double zoom,
+    pixman_region32_t *damage
+);
+
+#endif
@@ -0,0 +1,185 @@
+#include <string.h>
+#include <wlr/types/wlr_xdg_shell.h>
+
+#include "tearing-control-v1-protocol.h"
+#include "tearing_control.h"
+#include "types.h"
+
+
+/* Clients can hint through the tearing-control-v1 protocol that their surfaces
+ * would rather be shown as soon as possible than wait for the output's next
+ * scheduled repaint. Hints are only followed for views whose app_id has been
+ * allowed with `wimptool set allow_tearing`. */
+
+
+bool tearing_allowed(struct view *view) {
+    struct tearing_control *tearing_control = view->tearing_control;
+    bool wants_async = tearing_control &&
+	tearing_control->current == WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC;
+
+    const char *app_id = view->surface->toplevel->app_id;
+    if (!wants_async || !app_id) {
+	return false;
+    }
+    char **allowed;
+    wl_array_for_each(allowed, &wimp.tearing_allowed) {
+	if (!strcmp(*allowed, app_id)) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+
+void tearing_control_attach(struct view *view) {
+    /* A view was created for a surface, which may already have a tearing
+     * control object. */
+    struct tearing_control *tearing_control;
+    wl_list_for_each(tearing_control, &wimp.tearing_controls, link) {
+	if (tearing_control->surface == view->surface->surface) {
+	    tearing_control->view = view;
+	    view->tearing_control = tearing_control;
+	    return;
+	}
+    }
+}
+
+
+void tearing_control_detach(struct view *view) {
+    if (view->tearing_control) {
+	view->tearing_control->view = NULL;
+	view->tearing_control = NULL;
+    }
+}
+
+
+static void free_tearing_control(struct tearing_control *tearing_control) {
+    if (tearing_control->view) {
+	tearing_control->view->tearing_control = NULL;
+    }
+    wl_resource_set_user_data(tearing_control->resource, NULL);
+    wl_list_remove(&tearing_control->link);
+    wl_list_remove(&tearing_control->surface_commit_listener.link);
+    wl_list_remove(&tearing_control->surface_destroy_listener.link);
+    free(tearing_control);
+}
+
+
+static void on_resource_destroy(struct wl_resource *resource) {
+    struct tearing_control *tearing_control = wl_resource_get_user_data(resource);
+    if (tearing_control) {
+	free_tearing_control(tearing_control);
+    }
+}
+
+
+static void on_surface_commit(struct wl_listener *listener, void *data) {
+    struct tearing_control *tearing_control =
+	wl_container_of(listener, tearing_control, surface_commit_listener);
+    tearing_control->current = tearing_control->pending;
+}
+
+
+static void on_surface_destroy(struct wl_listener *listener, void *data) {
+    struct tearing_control *tearing_control =
+	wl_container_of(listener, tearing_control, surface_destroy_listener);
+    free_tearing_control(tearing_control);
+}
+
+
+static void handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+
+static void handle_set_presentation_hint(
+    struct wl_client *client, struct wl_resource *resource, uint32_t hint
+) {
+    struct tearing_control *tearing_control = wl_resource_get_user_data(resource);
+    if (tearing_control) {
+	tearing_control->pending = hint;
+    }
+}
+
+
+static const struct wp_tearing_control_v1_interface tearing_control_impl = {
+    .set_presentation_hint = handle_set_presentation_hint,
+    .destroy = handle_destroy,
+};
+
+
+static void get_tearing_control(
+    struct wl_client *client, struct wl_resource *manager_resource,
+    uint32_t id, struct wl_resource *surface_resource
+) {
+    struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+    struct tearing_control *tearing_control;
+    wl_list_for_each(tearing_control, &wimp.tearing_controls, link) {
+	if (tearing_control->surface == surface) {
+	    wl_resource_post_error(
+		manager_resource, WP_TEARING_CONTROL_MANAGER_V1_ERROR_TEARING_CONTROL_EXISTS,
+		"surface already has a tearing control object"
+	    );
+	    return;
+	}
+    }
+
+    tearing_control = calloc(1, sizeof(struct tearing_control));
+    if (!tearing_control) {
+	wl_client_post_no_memory(client);
+	return;
+    }
+    tearing_control->resource = wl_resource_create(
+	client, &wp_tearing_control_v1_interface, wl_resource_get_version(manager_resource), id
+    );
+    if (!tearing_control->resource) {
+	free(tearing_control);
+	wl_client_post_no_memory(client);
+	return;
+    }
+    wl_resource_set_implementation(
+	tearing_control->resource, &tearing_control_impl, tearing_control, on_resource_destroy
+    );
+
+    tearing_control->surface = surface;
+    tearing_control->current = WP_TEARING_CONTROL_V1_PRESENTATION_HINT_VSYNC;
+    tearing_control->pending = WP_TEARING_CONTROL_V1_PRESENTATION_HINT_VSYNC;
+    tearing_control->surface_commit_listener.notify = on_surface_commit;
+    tearing_control->surface_destroy_listener.notify = on_surface_destroy;
+    wl_signal_add(&surface->events.commit, &tearing_control->surface_commit_listener);
+    wl_signal_add(&surface->events.destroy, &tearing_control->surface_destroy_listener);
+    wl_list_insert(&wimp.tearing_controls, &tearing_control->link);
+
+    if (wlr_surface_is_xdg_surface(surface)) {
+	struct wlr_xdg_surface *xdg_surface = wlr_xdg_surface_from_wlr_surface(surface);
+	if (xdg_surface->role == WLR_XDG_SURFACE_ROLE_TOPLEVEL && xdg_surface->data) {
+	    tearing_control->view = xdg_surface->data;
+	    tearing_control->view->tearing_control = tearing_control;
+	}
+    }
+}
+
+
+static const struct wp_tearing_control_manager_v1_interface manager_impl = {
+    .destroy = handle_destroy,
+    .get_tearing_control = get_tearing_control,
+};
+
+
+static void bind_manager(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(
+	client, &wp_tearing_control_manager_v1_interface, version, id
+    );
+    if (!resource) {
+	wl_client_post_no_memory(client);
+	return;
+    }
+    wl_resource_set_implementation(resource, &manager_impl, NULL, NULL);
+}
+
+
+void set_up_tearing_control() {
+    wl_list_init(&wimp.tearing_controls);
+    wl_array_init(&wimp.tearing_allowed);
+    wl_global_create(wimp.display, &wp_tearing_control_manager_v1_interface, 1, NULL, bind_manager);
+}
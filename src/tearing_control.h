@@ -0,0 +1,11 @@
+#ifndef WIMP_TEARING_CONTROL_H
+#define WIMP_TEARING_CONTROL_H
+
+#include "types.h"
+
+bool tearing_allowed(struct view *view);
+void tearing_control_attach(struct view *view);
+void tearing_control_detach(struct view *view);
+void set_up_tearing_control();
+
+#endif
@@ -0,0 +1,152 @@
+#include <wlr/types/wlr_output_layout.h>
+
+#include "desk.h"
+#include "transaction.h"
+#include "types.h"
+
+
+/* Actions that change the geometry of several views at once, or that move a
+ * view and resize it, would otherwise show each client catching up in turn
+ * over several frames. Changes made between transaction_begin and
+ * transaction_commit are instead shown together: the outputs they touch stop
+ * being repainted until every client involved has committed a buffer for the
+ * configure it was sent, or until TRANSACTION_TIMEOUT passes. Frame callbacks
+ * are still sent meanwhile, once per refresh, so that clients keep drawing.
+ * Transactions committed while an earlier one is still waiting join it, and
+ * don't push back its deadline.
+ *
+ * Whole outputs are frozen, not just the views in the transaction, so a slow
+ * client also holds back what every other client on the same outputs shows
+ * for up to TRANSACTION_TIMEOUT. */
+
+
+static void freeze_outputs(struct wlr_box *box) {
+    struct wlr_box intersection;
+    struct output *output;
+    wl_list_for_each(output, &wimp.outputs, link) {
+	struct wlr_box *ogeo = wlr_output_layout_get_box(wimp.output_layout, output->wlr_output);
+	if (ogeo && wlr_box_intersection(&intersection, box, ogeo)) {
+	    output->in_transaction = true;
+	}
+    }
+}
+
+
+static void finish() {
+    wl_event_source_timer_update(wimp.transaction_timer, 0);
+    wimp.transaction_timer_armed = false;
+    wimp.transaction.size = 0;
+
+    struct output *output;
+    wl_list_for_each(output, &wimp.outputs, link) {
+	if (output->in_transaction) {
+	    output->in_transaction = false;
+	    wlr_output_schedule_frame(output->wlr_output);
+	}
+    }
+}
+
+
+static void remove_entry(struct transaction_entry *entry) {
+    struct transaction_entry *last =
+	(struct transaction_entry *)((char *)wimp.transaction.data + wimp.transaction.size) - 1;
+    *entry = *last;
+    wimp.transaction.size -= sizeof(struct transaction_entry);
+    if (wimp.transaction.size == 0 && wimp.transaction_depth == 0) {
+	finish();
+    }
+}
+
+
+void transaction_begin() {
+    wimp.transaction_depth++;
+}
+
+
+void transaction_add_view(struct view *view, uint32_t serial, struct wlr_box *new) {
+    /* A configure with this serial was sent to the view to give it a new
+     * geometry, given in layout coordinates. */
+    if (wimp.transaction_depth == 0 || serial == 0) {
+	return;
+    }
+
+    struct transaction_entry *entry;
+    bool found = false;
+    wl_array_for_each(entry, &wimp.transaction) {
+	if (entry->view == view) {
+	    entry->serial = serial;
+	    found = true;
+	    break;
+	}
+    }
+    if (!found) {
+	entry = wl_array_add(&wimp.transaction, sizeof(struct transaction_entry));
+	if (!entry) {
+	    return;
+	}
+	entry->view = view;
+	entry->serial = serial;
+    }
+
+    double zoom = view->is_scratchpad ? 1 : wimp.current_desk->zoom;
+    struct wlr_box old = {
+	.x = view_x(view) * zoom,
+	.y = view_y(view) * zoom,
+	.width = view->width * zoom,
+	.height = view->height * zoom,
+    };
+    freeze_outputs(&old);
+    freeze_outputs(new);
+}
+
+
+void transaction_view_committed(struct view *view) {
+    struct transaction_entry *entry;
+    wl_array_for_each(entry, &wimp.transaction) {
+	if (entry->view == view) {
+	    if ((int32_t)(view->surface->configure_serial - entry->serial) >= 0) {
+		remove_entry(entry);
+	    }
+	    return;
+	}
+    }
+}
+
+
+void transaction_remove_view(struct view *view) {
+    /* The view was unmapped so it won't be drawing for the transaction. */
+    struct transaction_entry *entry;
+    wl_array_for_each(entry, &wimp.transaction) {
+	if (entry->view == view) {
+	    remove_entry(entry);
+	    return;
+	}
+    }
+}
+
+
+void transaction_commit() {
+    if (--wimp.transaction_depth > 0) {
+	return;
+    }
+    if (wimp.transaction.size == 0) {
+	finish();
+    } else if (!wimp.transaction_timer_armed) {
+	wimp.transaction_timer_armed = true;
+	wl_event_source_timer_update(wimp.transaction_timer, TRANSACTION_TIMEOUT);
+    }
+}
+
+
+static int on_timeout(void *data) {
+    wlr_log(WLR_DEBUG, "Transaction timed out waiting for clients");
+    finish();
+    return 0;
+}
+
+
+void set_up_transactions() {
+    wl_array_init(&wimp.transaction);
+    struct wl_event_loop *event_loop = wl_display_get_event_loop(wimp.display);
+    wimp.transaction_timer = wl_event_loop_add_timer(event_loop, on_timeout, NULL);
+}
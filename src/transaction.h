@@ -0,0 +1,13 @@
+#ifndef WIMP_TRANSACTION_H
+#define WIMP_TRANSACTION_H
+
+#include "types.h"
+
+void transaction_begin();
+void transaction_add_view(struct view *view, uint32_t serial, struct wlr_box *new);
+void transaction_view_committed(struct view *view);
+void transaction_remove_view(struct view *view);
+void transaction_commit();
+void set_up_transactions();
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef WIMP_TYPES_H
 #define WIMP_TYPES_H
 
+#include <GLES2/gl2.h>
 #include <cairo/cairo.h>
+#include <pixman.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <wlr/backend.h>
@@ -24,6 +26,27 @@
 
 #define CORNER 24
 
+#define GRID_CELL 512
+#define GRID_BUCKETS 256
+
+#define RENDER_TIMES 8
+
+#define SNAPSHOT_ZOOM 0.5
+
+#define FRACTIONAL_SCALE_DEBOUNCE 250
+
+#define HIDDEN_FRAME_INTERVAL 1000
+
+#define ADAPTIVE_SYNC_IDLE 1000
+
+#define TRANSACTION_TIMEOUT 200
+
+#define RESIZE_TIMEOUT 200
+
+#define BINDING_BUCKET_BITS 6
+#define BINDING_BUCKETS (1 << BINDING_BUCKET_BITS)
+#define CHORD_MAX 8
+
 enum cursor_mode {
     CURSOR_PASSTHROUGH,
     CURSOR_MOD,
@@ -31,8 +54,18 @@ enum cursor_mode {
     CURSOR_RESIZE,
 };
 
+enum adaptive_sync {
+    ADAPTIVE_SYNC_OFF,
+    ADAPTIVE_SYNC_ON,
+    ADAPTIVE_SYNC_AUTO,
+};
+
 typedef void (*action)(void *data);
 
+struct binding_table {
+    struct wl_list buckets[BINDING_BUCKETS];
+};
+
 struct mark_indicator {
     float colour[4];
     struct wlr_box box;
@@ -57,7 +90,6 @@ struct wimp {
     int desk_count;
     struct desk *current_desk;
     struct wl_list marks;
-    bool mark_waiting;
     struct mark_indicator mark_indicator;
     bool bind_marks;
 
@@ -65,6 +97,18 @@ struct wimp {
     struct wl_listener decoration_listener;
     struct wlr_server_decoration_manager *server_decoration_manager;
 
+    struct wlr_presentation *presentation;
+    struct wl_list fractional_scales;
+    struct wl_event_source *fractional_scale_timer;
+    struct wl_list tearing_controls;
+    struct wl_array tearing_allowed;
+    struct wl_event_source *hidden_frame_timer;
+    unsigned int scene_generation;
+    int transaction_depth;
+    struct wl_array transaction;
+    struct wl_event_source *transaction_timer;
+    bool transaction_timer_armed;
+
     struct wlr_layer_shell_v1 *layer_shell;
     struct wl_listener layer_shell_surface_listener;
     struct layer_view *focussed_layer_view;
@@ -76,6 +120,13 @@ struct wimp {
     struct wl_listener cursor_button_listener;
     struct wl_listener cursor_axis_listener;
     struct wl_listener cursor_frame_listener;
+    struct wl_event_source *motion_timer;
+    bool motion_pending;
+    bool motion_unsent;
+    double motion_dx, motion_dy;
+    uint32_t motion_time;
+    double pointer_origin_x, pointer_origin_y, pointer_zoom;
+    unsigned int pointer_generation;
     struct wlr_pointer_gestures_v1 *pointer_gestures;
     struct wl_listener pinch_begin_listener;
     struct wl_listener pinch_update_listener;
@@ -90,7 +141,10 @@ struct wimp {
     struct wl_listener request_set_selection_listener;
     struct wl_list keyboards;
     enum wlr_keyboard_modifier mod;
-    struct wl_list key_bindings;
+    struct binding_table key_bindings;
+    struct wl_list binding_modes;
+    struct binding_mode *binding_mode;
+    struct binding_table *chord_waiting;
     struct wl_list mouse_bindings;
 
     struct wlr_virtual_keyboard_manager_v1 *virtual_keyboard;
@@ -112,6 +166,9 @@ struct wimp {
     uint32_t resize_edges;
     double zoom_min, zoom_max;
     bool auto_focus;
+    int max_render_time;
+    int lod_thumbnail, lod_proxy;
+    enum adaptive_sync adaptive_sync;
 
     bool can_snap;
     struct wlr_box snap_geobox;
@@ -123,6 +180,14 @@ struct wimp {
 
 extern struct wimp wimp;
 
+struct snapshot {
+    GLuint texture;
+    GLuint framebuffer;
+    int width, height;
+    double scale;
+    bool dirty;
+};
+
 struct view {
     struct wl_list link;
     struct wlr_xdg_surface *surface;
@@ -136,6 +201,19 @@ struct view {
     double x, y;
     int width, height;
     bool is_scratchpad;
+    struct desk *desk;
+    struct wl_list grid_entries;
+    long stack;
+    unsigned query_stamp;
+    struct wlr_output *primary_output;
+    struct snapshot snapshot;
+    uint32_t resize_serial;
+    bool resize_in_flight, resize_queued;
+    double resize_x, resize_y;
+    struct wlr_box resize_next;
+    struct wl_event_source *resize_timer;
+    struct tearing_control *tearing_control;
+    uint32_t shape;
 };
 
 struct output {
@@ -143,7 +221,20 @@ struct output {
     struct wl_list layer_views[4];
     struct wlr_output *wlr_output;
     struct wlr_output_damage *wlr_output_damage;
+    bool scanned_out;
+    struct wl_event_source *repaint_timer;
+    struct timespec last_presentation;
+    int refresh_nsec;
+    long render_times[RENDER_TIMES];
+    int render_time_index;
+    enum adaptive_sync adaptive_sync;
+    bool adaptive_sync_supported;
+    bool in_transaction;
+    bool frozen_frame_pending;
+    struct wl_event_source *frozen_frame_timer;
+    struct wl_event_source *idle_timer;
     struct wl_listener frame_listener;
+    struct wl_listener present_listener;
     struct wl_listener destroy_listener;
 };
 
@@ -156,6 +247,39 @@ struct layer_view {
     struct wl_listener destroy_listener;
     struct output *output;
     struct wlr_box geo;
+    uint32_t shape;
+};
+
+struct popup {
+    struct wlr_xdg_surface *surface;
+    uint32_t shape;
+    struct wl_listener map_listener;
+    struct wl_listener unmap_listener;
+    struct wl_listener commit_listener;
+    struct wl_listener destroy_listener;
+};
+
+struct fractional_scale {
+    struct wl_list link;
+    struct wl_resource *resource;
+    struct wlr_surface *surface;
+    uint32_t scale;
+    struct wl_listener surface_destroy_listener;
+};
+
+struct transaction_entry {
+    struct view *view;
+    uint32_t serial;
+};
+
+struct tearing_control {
+    struct wl_list link;
+    struct wl_resource *resource;
+    struct wlr_surface *surface;
+    struct view *view;
+    uint32_t current, pending;
+    struct wl_listener surface_commit_listener;
+    struct wl_listener surface_destroy_listener;
 };
 
 struct keyboard {
@@ -166,14 +290,73 @@ struct keyboard {
     struct wl_listener destroy_listener;
 };
 
+enum border_colour {
+    BORDER_NORMAL,
+    BORDER_FOCUS,
+    CORNER_NORMAL,
+    CORNER_FOCUS,
+    BORDER_COLOURS,
+};
+
+struct border_batch {
+    struct wlr_output *output;
+    pixman_region32_t covered;
+    pixman_region32_t regions[BORDER_COLOURS];
+};
+
 struct wallpaper {
     struct wlr_texture *texture;
     int width, height;
 };
 
+enum scene_layer {
+    SCENE_BACKGROUND,
+    SCENE_BOTTOM,
+    SCENE_VIEWS,
+    SCENE_SCRATCHPADS,
+    SCENE_TOP,
+    SCENE_OVERLAY,
+};
+
+enum detail {
+    DETAIL_FULL,
+    DETAIL_THUMBNAIL,
+    DETAIL_PROXY,
+};
+
+struct scene_node {
+    enum scene_layer layer;
+    enum detail detail;
+    struct view *view;
+    struct layer_view *lview;
+    double x, y;
+    double zoom;
+    pixman_region32_t clip;
+};
+
+struct grid_cell {
+    struct wl_list link;
+    int x, y;
+    struct wl_list entries;
+};
+
+struct grid_entry {
+    struct wl_list cell_link;
+    struct wl_list view_link;
+    struct grid_cell *cell;
+    struct view *view;
+};
+
+struct grid {
+    struct wl_list buckets[GRID_BUCKETS];
+    int cell_count;
+};
+
 struct desk {
     struct wl_list link;
     struct wl_list views;
+    struct grid grid;
+    long stack_top, stack_bottom;
     float background[4];
     float border_normal[4];
     float border_focus[4];
@@ -184,6 +367,8 @@ struct desk {
     double panned_x, panned_y;
     int index;
     double zoom;
+    bool outputs_dirty;
+    struct wlr_box shown_area;
     struct wlr_xdg_surface *fullscreened;
     struct wlr_box fullscreened_saved_geo;
 };
@@ -194,6 +379,18 @@ struct binding {
     uint32_t key;
     action action;
     void *data;
+    struct binding_table *chord;
+};
+
+struct binding_mode {
+    struct wl_list link;
+    char *name;
+    struct binding_table bindings;
+    // One-shot modes pass the next key pressed to any_key, then go back to
+    // the mode they were entered from.
+    void (*any_key)(xkb_keysym_t sym);
+    struct binding_mode *previous;
+    bool show_indicator;
 };
 
 struct motion {
@@ -0,0 +1,144 @@
+#include <GLES2/gl2.h>
+#include <math.h>
+#include <string.h>
+#include <wlr/render/gles2.h>
+
+#include "gl.h"
+#include "types.h"
+#include "wallpaper.h"
+
+
+/* Wallpapers repeat across the whole canvas. Rather than drawing one textured
+ * quad per repetition, which gets slower the further out the desk is zoomed,
+ * the visible background is drawn in a single draw call whose texture
+ * coordinates run past the edges of the image and are wrapped by the shader.
+ * They are wrapped with fract rather than GL_REPEAT because GLES2 only repeats
+ * textures whose sides are powers of two. */
+
+
+static const GLchar vertex_src[] =
+    "uniform mat3 proj;\n"
+    "attribute vec2 pos;\n"
+    "attribute vec2 texcoord;\n"
+    "varying vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
+    "    v_texcoord = texcoord;\n"
+    "}\n";
+
+static const GLchar fragment_src[] =
+    "precision mediump float;\n"
+    "varying vec2 v_texcoord;\n"
+    "uniform sampler2D tex;\n"
+    "uniform float opaque;\n"
+    "void main() {\n"
+    "    vec4 colour = texture2D(tex, fract(v_texcoord));\n"
+    "    gl_FragColor = opaque > 0.5 ? vec4(colour.rgb, 1.0) : colour;\n"
+    "}\n";
+
+static struct {
+    bool tried;
+    GLuint program;
+    GLint proj;
+    GLint pos;
+    GLint texcoord;
+    GLint tex;
+    GLint opaque;
+} shader = { 0 };
+
+
+static bool set_up_shader() {
+    /* The shader is built on first use, when the renderer's context is current. */
+    if (shader.tried) {
+	return shader.program != 0;
+    }
+    shader.tried = true;
+
+    if (!wlr_renderer_is_gles2(wimp.renderer)) {
+	return false;
+    }
+
+    GLuint program = gl_link_program(vertex_src, fragment_src);
+    if (!program) {
+	wlr_log(WLR_ERROR, "Failed to build wallpaper shader; wallpapers won't be drawn.");
+	return false;
+    }
+
+    shader.program = program;
+    shader.proj = glGetUniformLocation(program, "proj");
+    shader.pos = glGetAttribLocation(program, "pos");
+    shader.texcoord = glGetAttribLocation(program, "texcoord");
+    shader.tex = glGetUniformLocation(program, "tex");
+    shader.opaque = glGetUniformLocation(program, "opaque");
+    return true;
+}
+
+
+void wallpaper_render(
+    struct wallpaper *wallpaper, struct wlr_output *output, pixman_region32_t *region,
+    double origin_x, double origin_y, double scale
+) {
+    /* Draw the wallpaper wherever it is visible in region, which is in output
+     * pixels. One of its repetitions has its top left corner at origin_x,
+     * origin_y, and it is drawn scale times its size. */
+    if (!set_up_shader() || !wlr_texture_is_gles2(wallpaper->texture)) {
+	return;
+    }
+    struct wlr_gles2_texture_attribs attribs;
+    wlr_gles2_texture_get_attribs(wallpaper->texture, &attribs);
+    if (attribs.target != GL_TEXTURE_2D) {
+	return;
+    }
+
+    // Texture coordinates are kept small by starting each rectangle from the
+    // repetition it begins in, so that they stay precise far from the origin.
+    struct wl_array vertices;
+    wl_array_init(&vertices);
+    double width = wallpaper->width * scale;
+    double height = wallpaper->height * scale;
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+    for (int i = 0; i < nrects; i++) {
+	pixman_box32_t *r = &rects[i];
+	double u = (r->x1 - origin_x) / width;
+	double v = (r->y1 - origin_y) / height;
+	float u1 = u - floor(u);
+	float v1 = v - floor(v);
+	float u2 = u1 + (r->x2 - r->x1) / width;
+	float v2 = v1 + (r->y2 - r->y1) / height;
+	GLfloat quad[6][4] = {
+	    { r->x1, r->y1, u1, v1 }, { r->x2, r->y1, u2, v1 }, { r->x1, r->y2, u1, v2 },
+	    { r->x2, r->y1, u2, v1 }, { r->x2, r->y2, u2, v2 }, { r->x1, r->y2, u1, v2 },
+	};
+	GLfloat *vertex = wl_array_add(&vertices, sizeof(quad));
+	memcpy(vertex, quad, sizeof(quad));
+    }
+
+    if (vertices.size) {
+	float proj[9];
+	gl_output_projection(output, proj);
+	wlr_renderer_scissor(wimp.renderer, NULL);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, attribs.tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	GLsizei stride = 4 * sizeof(GLfloat);
+	GLfloat *data = vertices.data;
+	glUseProgram(shader.program);
+	glUniformMatrix3fv(shader.proj, 1, GL_FALSE, proj);
+	glUniform1i(shader.tex, 0);
+	glUniform1f(shader.opaque, attribs.has_alpha ? 0 : 1);
+	glVertexAttribPointer(shader.pos, 2, GL_FLOAT, GL_FALSE, stride, data);
+	glVertexAttribPointer(shader.texcoord, 2, GL_FLOAT, GL_FALSE, stride, data + 2);
+	glEnableVertexAttribArray(shader.pos);
+	glEnableVertexAttribArray(shader.texcoord);
+	glDrawArrays(GL_TRIANGLES, 0, vertices.size / stride);
+	glDisableVertexAttribArray(shader.pos);
+	glDisableVertexAttribArray(shader.texcoord);
+	glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    wl_array_release(&vertices);
+}
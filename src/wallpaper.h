@@ -0,0 +1,11 @@
+#ifndef WIMP_WALLPAPER_H
+#define WIMP_WALLPAPER_H
+
+#include "types.h"
+
+void wallpaper_render(
+    struct wallpaper *wallpaper, struct wlr_output *output, pixman_region32_t *region,
+    double origin_x, double origin_y, double scale
+);
+
+#endif